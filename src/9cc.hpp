@@ -1,3 +1,6 @@
+#pragma once
+
+#include <functional>
 #include <vector>
 #include <string>
 
@@ -15,6 +18,7 @@ enum {
     TK_ELSE,       //! else
     TK_FOR,        //! for
     TK_WHILE,      //! while
+    TK_NUM_KINDS,  //! トークンの型の数
 };
 
 // トークンの型
@@ -36,8 +40,14 @@ enum {
 };
 
 struct Node {
+    const char *loc = nullptr;  //! 文の先頭のソース上の位置（デバッグ情報用、式ではnullptr）
+
     virtual void gen(struct GenContext &) = 0;
     virtual void gen_lval(struct GenContext &) = 0;
+    //! 子ノードを評価順に渡す（nullptrの子は渡さない）
+    virtual void each_child(const std::function<void(Node *&)> &) = 0;
+    //! 子ノードも含めて複製する
+    virtual Node *clone() const = 0;
 };
 
 struct NodeGeneral : public Node {
@@ -49,6 +59,8 @@ struct NodeGeneral : public Node {
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
 struct NodeNum : public Node {
@@ -58,6 +70,8 @@ struct NodeNum : public Node {
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
 struct NodeIdent : public Node {
@@ -67,17 +81,23 @@ struct NodeIdent : public Node {
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
 struct NodeIf : public Node {
     struct Node* cond;
     struct Node* then;
     struct Node* els;
+    int probe = -1;  //! 実行回数の計測番号（thenがprobe、elseがprobe+1）
+    bool branchless = false;  //! 分岐せずcmovで値を選ぶ
 
     NodeIf(Node* cond, Node* then, Node* els): cond(cond), then(then), els(els) {}
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
 struct NodeFor : public Node {
@@ -85,22 +105,28 @@ struct NodeFor : public Node {
     struct Node* cond;
     struct Node* proc;
     struct Node* block;
+    int probe = -1;  //! 実行回数の計測番号（ループを回った回数）
 
     NodeFor(Node* init, Node* cond, Node* proc, Node* block)
         : init(init), cond(cond), proc(proc), block(block) {}
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
 struct NodeWhile: public Node {
     struct Node* cond;
     struct Node* block;
+    int probe = -1;  //! 実行回数の計測番号（ループを回った回数）
 
     NodeWhile(Node* cond, Node* block): cond(cond), block(block){}
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
 struct NodeBlock: public Node {
@@ -110,12 +136,124 @@ struct NodeBlock: public Node {
 
     void gen(struct GenContext &) override;
     void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
 };
 
+// パース中に見つかったエラー
+struct Diagnostic {
+    const char *loc;  //! エラー位置（入力文字列中のポインタ）
+    std::string msg;  //! エラーメッセージ
+};
+
+struct NodeCall: public Node {
+    std::string name;
+    std::vector<Node*> args;
+
+    NodeCall(const std::string &name, std::vector<Node*>&& args): name(name), args(args) {}
+
+    void gen(struct GenContext &) override;
+    void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
+};
+
+// 関数定義
+// トップレベルに直接書かれた文は暗黙のmain関数にまとめられる
+struct NodeFunc: public Node {
+    std::string name;
+    std::vector<std::string> params;  //! 引数名（localsの先頭と同じ並び）
+    std::vector<std::string> locals;  //! 引数を含むローカル変数名（出現順）
+    std::vector<Node*> body;
+    //! レジスタに置くローカル変数とそのレジスタ名（promote_localsが決める）
+    std::vector<std::pair<std::string, std::string>> reg_locals;
+
+    NodeFunc(const std::string &name, std::vector<std::string>&& params)
+        : name(name), params(params), locals(params) {}
+
+    void gen(struct GenContext &) override;
+    void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
+};
+
+// インライン展開された関数呼び出し
+// 実引数を展開先のローカル変数に代入してから本体を実行する
+struct NodeInline: public Node {
+    std::string callee;
+    std::vector<Node*> args;
+    std::vector<std::string> params;  //! 呼び出し元のローカル変数に改名した引数
+    std::vector<Node*> body;          //! 呼び出し元のローカル変数に改名した本体
+    std::string sp_slot;              //! 途中のreturn用にrspを保存する変数（不要なら空）
+
+    NodeInline(const std::string &callee, std::vector<Node*>&& args,
+               std::vector<std::string>&& params, std::vector<Node*>&& body,
+               const std::string &sp_slot)
+        : callee(callee), args(args), params(params), body(body), sp_slot(sp_slot) {}
+
+    void gen(struct GenContext &) override;
+    void gen_lval(struct GenContext &) override;
+    void each_child(const std::function<void(Node *&)> &) override;
+    Node *clone() const override;
+};
+
+// System V ABIで引数を渡すレジスタの数
+constexpr int MAX_ARGS = 6;
+
+// 構文木を再帰でたどる最適化や命令選択をかける、構文木の深さの上限
+// これより深い関数（機械が生成した深い式など）は再帰しないコード生成だけで扱う
+constexpr int MAX_OPT_DEPTH = 256;
+
+// インライン展開する関数の大きさ（本体のノード数）の既定の上限
+constexpr int DEFAULT_INLINE_BUDGET = 32;
+
+// 分岐・ループの実行回数のプロファイル
+struct Profile {
+    bool instrument = false;   //! 実行回数を数えるコードを埋め込む
+    std::string path;          //! 計測結果の出力先
+    int num_probes = 0;        //! 計測箇所の数
+    unsigned long hash = 0;    //! 入力プログラムのハッシュ（計測時と利用時の照合用）
+    std::vector<long> counts;  //! 読み込んだ実行回数（空ならプロファイルなし）
+    long max_count = 0;
+
+    bool loaded() const { return !counts.empty(); }
+    long count(int probe) const { return probe < 0 || !loaded() ? 0 : counts[probe]; }
+    bool hot(int probe) const;
+    bool cold(int probe, int other) const;
+};
+
+extern Profile profile;
+
 extern std::vector<Token> tokens;
+extern std::vector<Diagnostic> diagnostics;
+extern const char *user_input;
+extern const char *input_name;
 
 void tokenize(const char *p);
-std::vector<Node*> parse();
-void code_gen(std::vector<Node*>& code);
+std::vector<NodeFunc*> parse();
+void save_ast(const char *path, std::vector<NodeFunc*>& code);
+std::vector<NodeFunc*> load_ast(const char *path);
+bool code_gen(std::vector<NodeFunc*>& code, bool debug_info, int jobs);
+int interpret(std::vector<NodeFunc*>& code);
+int count_nodes(Node *node);
+bool deeper_than(Node *node, int limit);
+bool too_deep(NodeFunc *func);
+void inline_functions(std::vector<NodeFunc*>& code, int budget, bool report);
+void eliminate_common_subexpressions(std::vector<NodeFunc*>& code);
+void promote_locals(std::vector<NodeFunc*>& code);
+void select_branchless(std::vector<NodeFunc*>& code);
+void run_optimizations(std::vector<NodeFunc*>& code, int inline_budget, bool inline_report);
+void assign_probes(std::vector<NodeFunc*>& code);
+bool load_profile(const char *path);
+void gen_profile_runtime();
+
+// ソース上の位置（1始まり）
+struct SourcePos {
+    int line;
+    int col;
+};
 
+SourcePos source_pos(const char *loc);
 void error(const char *fmt, ...);
+void error_at(const char *loc, const char *fmt, ...);
+int report_diagnostics();
@@ -0,0 +1,106 @@
+#include "9cc.hpp"
+
+// 自分自身を複製してから、子ノードをそれぞれ複製したものに差し替える
+template <typename T>
+static Node *deep_copy(const T *node) {
+    auto copy = new T(*node);
+    copy->each_child([](Node *&child) { child = child->clone(); });
+    return copy;
+}
+
+void NodeGeneral::each_child(const std::function<void(Node *&)> &f) {
+    if (lhs) f(lhs);
+    if (rhs) f(rhs);
+}
+
+Node *NodeGeneral::clone() const { return deep_copy(this); }
+
+void NodeNum::each_child(const std::function<void(Node *&)> &) {}
+
+Node *NodeNum::clone() const { return deep_copy(this); }
+
+void NodeIdent::each_child(const std::function<void(Node *&)> &) {}
+
+Node *NodeIdent::clone() const { return deep_copy(this); }
+
+void NodeIf::each_child(const std::function<void(Node *&)> &f) {
+    f(cond);
+    f(then);
+    if (els) f(els);
+}
+
+Node *NodeIf::clone() const { return deep_copy(this); }
+
+void NodeFor::each_child(const std::function<void(Node *&)> &f) {
+    if (init) f(init);
+    if (cond) f(cond);
+    if (block) f(block);
+    if (proc) f(proc);
+}
+
+Node *NodeFor::clone() const { return deep_copy(this); }
+
+void NodeWhile::each_child(const std::function<void(Node *&)> &f) {
+    if (cond) f(cond);
+    if (block) f(block);
+}
+
+Node *NodeWhile::clone() const { return deep_copy(this); }
+
+void NodeBlock::each_child(const std::function<void(Node *&)> &f) {
+    for (auto &n : block) f(n);
+}
+
+Node *NodeBlock::clone() const { return deep_copy(this); }
+
+void NodeCall::each_child(const std::function<void(Node *&)> &f) {
+    for (auto &n : args) f(n);
+}
+
+Node *NodeCall::clone() const { return deep_copy(this); }
+
+void NodeFunc::each_child(const std::function<void(Node *&)> &f) {
+    for (auto &n : body) f(n);
+}
+
+Node *NodeFunc::clone() const { return deep_copy(this); }
+
+void NodeInline::each_child(const std::function<void(Node *&)> &f) {
+    for (auto &n : args) f(n);
+    for (auto &n : body) f(n);
+}
+
+Node *NodeInline::clone() const { return deep_copy(this); }
+
+// nodeを根とする部分木のノード数
+// 深い木でもスタックを使い切らないよう、再帰せずに数える
+int count_nodes(Node *node) {
+    int n = 0;
+    std::vector<Node *> stack{node};
+    while (!stack.empty()) {
+        auto top = stack.back();
+        stack.pop_back();
+        n++;
+        top->each_child([&](Node *&child) { stack.push_back(child); });
+    }
+    return n;
+}
+
+// nodeを根とする部分木の深さがlimitを超えるか（再帰せずに調べる）
+bool deeper_than(Node *node, int limit) {
+    std::vector<std::pair<Node *, int>> stack{{node, 1}};
+    while (!stack.empty()) {
+        auto [top, depth] = stack.back();
+        stack.pop_back();
+        if (depth > limit) return true;
+        top->each_child([&](Node *&child) { stack.push_back({child, depth + 1}); });
+    }
+    return false;
+}
+
+// 関数本体が深すぎて、構文木を再帰でたどる最適化をかけられないか
+bool too_deep(NodeFunc *func) {
+    for (auto n : func->body)
+        if (deeper_than(n, MAX_OPT_DEPTH)) return true;
+    return false;
+}
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "bytecode.hpp"
+
+// 構文木をレジスタマシンのバイトコードに変換する
+//
+// ローカル変数は関数ごとのレジスタに1つずつ割り当て、式の途中の値は
+// その後ろの一時レジスタに置く。一時レジスタは式の評価順に積み、
+// 使い終わったら後に確保したものから解放する。
+
+// 代入を含む部分木を集める（深い式でもスタックを使い切らないよう、再帰せずにたどる）
+static void collect_assigning(Node *root, std::unordered_set<Node *> &out) {
+    std::vector<std::pair<Node *, bool>> stack{{root, false}};
+    while (!stack.empty()) {
+        auto [node, visited] = stack.back();
+        stack.pop_back();
+        if (!visited) {
+            stack.push_back({node, true});
+            node->each_child([&](Node *&child) { stack.push_back({child, false}); });
+            continue;
+        }
+
+        auto n = dynamic_cast<NodeGeneral *>(node);
+        bool assigns = (n && n->ty == '=') || dynamic_cast<NodeInline *>(node);
+        node->each_child([&](Node *&child) { assigns = assigns || out.count(child); });
+        if (assigns) out.insert(node);
+    }
+}
+
+// ADDIの即値に収まるか
+static bool fits_imm16(long v) { return INT16_MIN <= v && v <= INT16_MAX; }
+
+struct BcCompiler {
+    BcModule &module;
+    std::unordered_map<std::string, int> funcs;    //! 関数名から関数の番号
+    std::unordered_map<std::string, int> externs;  //! 外部の関数名から番号
+    BcFunc *func = nullptr;
+    std::unordered_map<std::string, int> vars;  //! 変数を置いたレジスタ
+    int num_vars = 0;
+    int next_temp = 0;  //! 次に確保する一時レジスタ
+
+    // 展開中のインライン関数（return文は結果をresultに置いて末尾へ抜ける）
+    struct InlineFrame {
+        int result;
+        std::vector<size_t> exits;  //! 末尾への分岐命令の位置
+    };
+    std::vector<InlineFrame> inline_frames;
+
+    explicit BcCompiler(BcModule &module) : module(module) {}
+
+    size_t emit(Op op, int a = 0, int b = 0, int c = 0);
+    // 分岐命令atの飛び先を次に出力する命令にする
+    void patch(size_t at) { func->code[at].set_imm(func->code.size()); }
+    int temp();
+    bool is_temp(int reg) const { return reg >= num_vars; }
+    void release(int reg);
+    int var(const std::string &name);
+    int call_target(const std::string &name, bool &is_extern);
+
+    int expr(Node *root, int dst);
+    int inline_expr(NodeInline *node);
+    int stmt(Node *node, bool use_value = false);
+    void loop(Node *cond, Node *block, Node *proc);
+    void function(NodeFunc *f);
+};
+
+size_t BcCompiler::emit(Op op, int a, int b, int c) {
+    Insn insn{op};
+    insn.a = a;
+    insn.b = b;
+    insn.c = c;
+    func->code.push_back(insn);
+    return func->code.size() - 1;
+}
+
+int BcCompiler::temp() {
+    int reg = next_temp++;
+    if (next_temp > MAX_REGS)
+        error("式が複雑すぎてインタプリタのレジスタに収まりません: %s", func->name.c_str());
+    func->num_regs = std::max(func->num_regs, next_temp);
+    return reg;
+}
+
+// 一時レジスタは確保と逆順に解放するので、解放した位置から後ろを再利用する
+void BcCompiler::release(int reg) {
+    if (is_temp(reg)) next_temp = std::min(next_temp, reg);
+}
+
+int BcCompiler::var(const std::string &name) {
+    auto iter = vars.find(name);
+    if (iter == vars.end()) error("未定義の変数です: %s", name.c_str());
+    return iter->second;
+}
+
+int BcCompiler::call_target(const std::string &name, bool &is_extern) {
+    auto iter = funcs.find(name);
+    is_extern = iter == funcs.end();
+    if (!is_extern) return iter->second;
+
+    auto ext = externs.find(name);
+    if (ext != externs.end()) return ext->second;
+    module.externs.push_back(name);
+    return externs[name] = module.externs.size() - 1;
+}
+
+// 式の値を計算するコードを出力し、値を置いたレジスタを返す
+// dstが0以上なら、できるだけそのレジスタに値を置く（置けなければ呼び出し側で移す）
+//
+// 深い式でもスタックを使い切らないよう、作業スタックを使って帰りがけ順に処理する。
+int BcCompiler::expr(Node *root, int dst) {
+    enum State {
+        VISIT,   //! 子を積む（葉ならそのまま値を積む）
+        FINISH,  //! 子の値から自分の値を計算する
+        PIN,     //! 左辺が変数なら、右辺の代入で変わる前に一時レジスタに写す
+        FIX,     //! 引数の値を所定のレジスタに移す
+    };
+    struct Work {
+        Node *node;
+        State state;
+        int dst;
+    };
+
+    std::unordered_set<Node *> assigning;
+    collect_assigning(root, assigning);
+
+    std::vector<Work> works{{root, VISIT, dst}};
+    std::vector<int> values;
+
+    while (!works.empty()) {
+        auto w = works.back();
+        works.pop_back();
+
+        if (w.state == PIN) {
+            int l = values.back();
+            if (!is_temp(l)) {
+                int t = temp();
+                emit(OP_MOV, t, l);
+                values.back() = t;
+            }
+            continue;
+        }
+
+        if (w.state == FIX) {
+            int v = values.back();
+            values.pop_back();
+            if (v != w.dst) {
+                emit(OP_MOV, w.dst, v);
+                release(v);
+            }
+            continue;
+        }
+
+        if (auto n = dynamic_cast<NodeNum *>(w.node)) {
+            int r = w.dst >= 0 ? w.dst : temp();
+            Insn insn{OP_LOADI};
+            insn.a = r;
+            insn.set_imm(n->val);
+            func->code.push_back(insn);
+            values.push_back(r);
+            continue;
+        }
+
+        if (auto n = dynamic_cast<NodeIdent *>(w.node)) {
+            values.push_back(var(n->name));
+            continue;
+        }
+
+        if (auto n = dynamic_cast<NodeInline *>(w.node)) {
+            values.push_back(inline_expr(n));
+            continue;
+        }
+
+        if (auto n = dynamic_cast<NodeCall *>(w.node)) {
+            int nargs = n->args.size();
+            if (w.state == VISIT) {
+                // 引数は連続したレジスタに置く（引数がなくても返り値の置き場を確保する）
+                int base = next_temp;
+                for (int i = 0; i < std::max(nargs, 1); i++) temp();
+                works.push_back({n, FINISH, base});
+                for (int i = nargs - 1; i >= 0; i--) {
+                    works.push_back({n->args[i], FIX, base + i});
+                    works.push_back({n->args[i], VISIT, base + i});
+                }
+                continue;
+            }
+
+            bool is_extern;
+            int target = call_target(n->name, is_extern);
+            emit(is_extern ? OP_CALLX : OP_CALL, w.dst, nargs, target);
+            next_temp = w.dst + 1;
+            values.push_back(w.dst);
+            continue;
+        }
+
+        auto n = dynamic_cast<NodeGeneral *>(w.node);
+        if (!n || n->ty == ND_RETURN) error("式ではありません");
+
+        if (n->ty == '=') {
+            auto ident = dynamic_cast<NodeIdent *>(n->lhs);
+            if (!ident) error("代入の左辺値が変数ではありません");
+            int x = var(ident->name);
+
+            if (w.state == VISIT) {
+                works.push_back({n, FINISH, w.dst});
+                works.push_back({n->rhs, VISIT, x});
+                continue;
+            }
+
+            int v = values.back();
+            values.pop_back();
+            if (v != x) emit(OP_MOV, x, v);
+            release(v);
+            values.push_back(x);
+            continue;
+        }
+
+        // x + 定数、x - 定数は即値を使う
+        long imm = 0;
+        auto num = dynamic_cast<NodeNum *>(n->rhs);
+        if (num) imm = n->ty == '-' ? -static_cast<long>(num->val) : num->val;
+        bool use_imm = num && (n->ty == '+' || n->ty == '-') && fits_imm16(imm);
+
+        if (w.state == VISIT) {
+            works.push_back({n, FINISH, w.dst});
+            if (use_imm) {
+                works.push_back({n->lhs, VISIT, -1});
+                continue;
+            }
+            works.push_back({n->rhs, VISIT, -1});
+            if (assigning.count(n->rhs)) works.push_back({n, PIN, -1});
+            works.push_back({n->lhs, VISIT, -1});
+            continue;
+        }
+
+        if (use_imm) {
+            int l = values.back();
+            values.pop_back();
+            release(l);
+            int d = w.dst >= 0 ? w.dst : temp();
+            emit(OP_ADDI, d, l, static_cast<uint16_t>(imm));
+            values.push_back(d);
+            continue;
+        }
+
+        int r = values.back();
+        values.pop_back();
+        int l = values.back();
+        values.pop_back();
+        release(r);
+        release(l);
+        int d = w.dst >= 0 ? w.dst : temp();
+
+        switch (n->ty) {
+        case '+': emit(OP_ADD, d, l, r); break;
+        case '-': emit(OP_SUB, d, l, r); break;
+        case '*': emit(OP_MUL, d, l, r); break;
+        case '/': emit(OP_DIV, d, l, r); break;
+        case ND_EQ: emit(OP_EQ, d, l, r); break;
+        case ND_NE: emit(OP_NE, d, l, r); break;
+        case '<': emit(OP_LT, d, l, r); break;
+        case ND_LE: emit(OP_LE, d, l, r); break;
+        case '>': emit(OP_LT, d, r, l); break;
+        case ND_GE: emit(OP_LE, d, r, l); break;
+        default: error("未対応の演算です: %d", n->ty);
+        }
+        values.push_back(d);
+    }
+
+    return values.back();
+}
+
+// インライン展開した関数の本体を出力し、結果を置いたレジスタを返す
+int BcCompiler::inline_expr(NodeInline *node) {
+    int nargs = node->args.size();
+    int base = next_temp;
+    for (int i = 0; i < nargs; i++) temp();
+    for (int i = 0; i < nargs; i++) {
+        int v = expr(node->args[i], base + i);
+        if (v != base + i) emit(OP_MOV, base + i, v);
+        next_temp = base + nargs;
+    }
+    for (int i = 0; i < nargs; i++) emit(OP_MOV, var(node->params[i]), base + i);
+    next_temp = base;
+
+    int result = temp();
+    inline_frames.push_back({result, {}});
+    int v = -1;
+    for (auto s : node->body) v = stmt(s, s == node->body.back());
+    if (v >= 0 && v != result) emit(OP_MOV, result, v);
+
+    for (auto at : inline_frames.back().exits) patch(at);
+    inline_frames.pop_back();
+    return result;
+}
+
+// 文のコードを出力し、文の値を置いたレジスタ（値がなければ-1）を返す
+// 文の途中で使った一時レジスタは、文を抜けるときに解放する
+// use_valueは文の値を使うか（関数やブロックの最後の文）で、偽ならifの値はまとめない
+//
+// ifの値は通った方の文の値で、ネイティブのコードと同じ。ただし省略した腕やループ、
+// 値のない文の後でネイティブのコードのraxに残る値は命令選択次第で決まらないので、
+// インタプリタではifの腕の値を0とし、ループは値を持たないものとする。
+int BcCompiler::stmt(Node *node, bool use_value) {
+    int mark = next_temp;
+    int value = -1;
+
+    if (auto n = dynamic_cast<NodeIf *>(node)) {
+        int c = expr(n->cond, -1);
+        next_temp = mark;
+        auto to_else = emit(OP_JZ, c);
+
+        // 値を使うときは、両方の腕の値を1つのレジスタにまとめる
+        if (use_value) value = temp();
+        auto arm = [&](Node *s) {
+            int v = s ? stmt(s, use_value) : -1;
+            if (!use_value) return;
+            if (v < 0) emit(OP_LOADI, value);
+            else if (v != value) emit(OP_MOV, value, v);
+        };
+        arm(n->then);
+        if (n->els || use_value) {
+            auto to_end = emit(OP_JMP);
+            patch(to_else);
+            arm(n->els);
+            patch(to_end);
+        } else {
+            patch(to_else);
+        }
+    } else if (auto n = dynamic_cast<NodeFor *>(node)) {
+        if (n->init) stmt(n->init);
+        loop(n->cond, n->block, n->proc);
+    } else if (auto n = dynamic_cast<NodeWhile *>(node)) {
+        loop(n->cond, n->block, nullptr);
+    } else if (auto n = dynamic_cast<NodeBlock *>(node)) {
+        for (auto s : n->block) value = stmt(s, use_value && s == n->block.back());
+    } else if (auto n = dynamic_cast<NodeGeneral *>(node); n && n->ty == ND_RETURN) {
+        if (inline_frames.empty()) {
+            emit(OP_RET, expr(n->lhs, -1));
+        } else {
+            auto &frame = inline_frames.back();
+            int v = expr(n->lhs, frame.result);
+            if (v != frame.result) emit(OP_MOV, frame.result, v);
+            inline_frames.back().exits.push_back(emit(OP_JMP));
+        }
+    } else {
+        value = expr(node, -1);
+    }
+
+    next_temp = mark;
+    return value;
+}
+
+// ループは条件判定を末尾に置き、1周あたりの分岐を1つにする
+void BcCompiler::loop(Node *cond, Node *block, Node *proc) {
+    int mark = next_temp;
+    auto to_cond = emit(OP_JMP);
+    size_t begin = func->code.size();
+    if (block) stmt(block);
+    if (proc) stmt(proc);
+
+    patch(to_cond);
+    if (cond) {
+        int c = expr(cond, -1);
+        func->code[emit(OP_JNZ, c)].set_imm(begin);
+    } else {
+        func->code[emit(OP_JMP)].set_imm(begin);
+    }
+    next_temp = mark;
+}
+
+void BcCompiler::function(NodeFunc *f) {
+    vars.clear();
+    for (auto &v : f->locals) vars.insert({v, static_cast<int>(vars.size())});
+    num_vars = vars.size();
+    next_temp = num_vars;
+    func->num_params = f->params.size();
+    func->num_regs = num_vars;
+    if (num_vars >= MAX_REGS) error("変数が多すぎます: %s", f->name.c_str());
+
+    // 最後の文の値が返り値になる
+    int v = -1;
+    for (auto n : f->body) v = stmt(n, n == f->body.back());
+    if (v < 0) {
+        v = temp();
+        emit(OP_LOADI, v);
+    }
+    emit(OP_RET, v);
+}
+
+BcModule compile_bytecode(std::vector<NodeFunc *> &code) {
+    BcModule module;
+    BcCompiler compiler(module);
+
+    for (auto f : code) {
+        compiler.funcs[f->name] = module.funcs.size();
+        module.funcs.push_back(BcFunc{f->name});
+        if (f->name == "main") module.main = module.funcs.size() - 1;
+    }
+    if (module.funcs.size() > UINT16_MAX) error("関数が多すぎます");
+
+    for (size_t i = 0; i < code.size(); i++) {
+        compiler.func = &module.funcs[i];
+        compiler.function(code[i]);
+    }
+    if (module.externs.size() > UINT16_MAX) error("外部の関数が多すぎます");
+    return module;
+}
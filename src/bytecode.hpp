@@ -0,0 +1,62 @@
+// バイトコードの定義（bytecode.cppで生成し、interp.cppで実行する）
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "9cc.hpp"
+
+// 命令の種類
+// オペランドはレジスタ番号a, b, cか、b, cを合わせた32ビットの即値
+enum Op : uint8_t {
+    OP_MOV,    //! a = b
+    OP_LOADI,  //! a = imm
+    OP_ADD,    //! a = b + c
+    OP_ADDI,   //! a = b + c（cは符号付き16ビットの即値）
+    OP_SUB,    //! a = b - c
+    OP_MUL,    //! a = b * c
+    OP_DIV,    //! a = b / c（符号なし）
+    OP_EQ,     //! a = b == c
+    OP_NE,     //! a = b != c
+    OP_LT,     //! a = b < c
+    OP_LE,     //! a = b <= c
+    OP_JMP,    //! imm番目の命令へ
+    OP_JZ,     //! aが0ならimm番目の命令へ
+    OP_JNZ,    //! aが0でなければimm番目の命令へ
+    OP_CALL,   //! 関数cをa以降のb個のレジスタを引数として呼び、返り値をaに置く
+    OP_CALLX,  //! 外部の関数cを同様に呼ぶ
+    OP_RET,    //! aを返り値として戻る
+    NUM_OPS,
+};
+
+// 1命令（8バイト）
+struct Insn {
+    Op op;
+    uint8_t unused = 0;
+    uint16_t a = 0, b = 0, c = 0;
+
+    int32_t imm() const { return static_cast<int32_t>(b | static_cast<uint32_t>(c) << 16); }
+    void set_imm(int32_t v) {
+        b = static_cast<uint32_t>(v) & 0xffff;
+        c = static_cast<uint32_t>(v) >> 16;
+    }
+};
+
+// レジスタ番号の上限（オペランドが16ビットなので）
+constexpr int MAX_REGS = 65536;
+
+struct BcFunc {
+    std::string name;
+    int num_params = 0;
+    int num_regs = 0;  //! ローカル変数（引数が先頭）と一時変数の合計
+    std::vector<Insn> code;
+};
+
+struct BcModule {
+    std::vector<BcFunc> funcs;
+    std::vector<std::string> externs;  //! 呼び出す外部の関数の名前
+    int main = -1;                     //! main関数の番号
+};
+
+BcModule compile_bytecode(std::vector<NodeFunc *> &code);
@@ -1,31 +1,40 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
 #include <cstdio>
-#include <unordered_map>
 #include <string>
+#include <thread>
 
 #include "9cc.hpp"
+#include "codegen.hpp"
 
-struct GenContext {
-    std::unordered_map<std::string, int> vars;
-    int current_offset = 0;
-    int label_index = 0;
-
-    int var_put(const std::string& var) {
-        auto iter = vars.find(var);
-        if (iter != vars.end()) {
-            return iter->second;
-        }
+thread_local FILE *code_out = nullptr;
 
-        current_offset += 8;
-        vars.insert({var, current_offset});
-        return current_offset;
-    }
+void emit(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(code_out ? code_out : stdout, fmt, ap);
+    va_end(ap);
+}
 
-    std::string new_label() {
-        char buf[100];
-        sprintf(buf, ".Label%d", label_index++);
-        return std::string(buf);
+// sをアセンブラの文字列リテラル（.stringや.fileの引数）の中身として書いたもの
+// "と\はエスケープし、制御文字は8進数で書く
+std::string asm_string(const std::string& s) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20 || c == 0x7f) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\%03o", c);
+            out += buf;
+        } else {
+            out += c;
+        }
     }
-};
+    return out;
+}
 
 void NodeGeneral::gen_lval(GenContext&) {
     error("代入の左辺値が変数ではありません");
@@ -35,140 +44,198 @@ void NodeNum::gen_lval(GenContext&) {
     error("代入の左辺値が変数ではありません");
 }
 
+// 変数nameにレジスタsrcの値を書き込む
+static void gen_store(GenContext& context, const std::string& name, const char *src) {
+    if (auto reg = context.reg_of(name)) {
+        emit("  mov %s, %s\n", reg, src);
+    } else {
+        emit("  mov [rbp-%d], %s\n", context.var_put(name), src);
+    }
+}
+
 void NodeIdent::gen_lval(GenContext& context) {
+    if (context.reg_of(name)) error("レジスタに置いた変数のアドレスは取れません: %s", name.c_str());
     int offset = context.var_put(name);
-    printf("  mov rax, rbp\n");
-    printf("  sub rax, %d\n", offset);
-    printf("  push rax\n");
+    emit("  mov rax, rbp\n");
+    emit("  sub rax, %d\n", offset);
+    emit("  push rax\n");
 }
 
 void NodeNum::gen(GenContext& context) {
-    printf("  push %d\n", val);
+    emit("  push %d\n", val);
     return;
 }
 
 void NodeIdent::gen(GenContext& context) {
+    if (auto reg = context.reg_of(name)) {
+        emit("  push %s\n", reg);
+        return;
+    }
     gen_lval(context);
-    printf("  pop rax\n");
-    printf("  mov rax, [rax]\n");
-    printf("  push rax\n");
+    emit("  pop rax\n");
+    emit("  mov rax, [rax]\n");
+    emit("  push rax\n");
     return;
 }
 
-void NodeGeneral::gen(GenContext& context) {
-    if (ty == '=') {
-        lhs->gen_lval(context);
-        rhs->gen(context);
-
-        printf("  pop rdi\n");
-        printf("  pop rax\n");
-        printf("  mov [rax], rdi\n");
-        printf("  push rdi\n");
+// raxの値を返り値としてreturnする
+// インライン展開の中なら、展開開始時のrspに戻してから展開の末尾へ抜ける
+void gen_return_jump(GenContext& context) {
+    if (!context.inline_frames.empty()) {
+        auto &frame = context.inline_frames.back();
+        emit("  mov rsp, [rbp-%d]\n", frame.sp_offset);
+        emit("  jmp %s\n", frame.end_label.c_str());
         return;
     }
+    emit("  jmp %s\n", context.return_label.c_str());
+}
 
+// 演算と代入は命令選択（isel.cpp）で式の木ごとにまとめてraxへ計算する
+void NodeGeneral::gen(GenContext& context) {
     if (ty == ND_RETURN) {
-        lhs->gen(context);
-        printf("  pop rax\n");
-        printf("  mov rsp, rbp\n");
-        printf("  pop rbp\n");
-        printf("  ret\n");
+        gen_expr(lhs, context);
+        gen_return_jump(context);
         return;
     }
 
-    lhs->gen(context);
-    rhs->gen(context);
-
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
-
-    switch (ty) {
-    case '+':
-        printf("  add rax, rdi\n");
-        break;
-    case '-':
-        printf("  sub rax, rdi\n");
-        break;
-    case '*':
-        printf("  mul rdi\n");
-        break;
-    case '/':
-        printf("  mov rdx, 0\n");
-        printf("  div rdi\n");
-        break;
-    case ND_EQ:
-        printf("  cmp rax, rdi\n");
-        printf("  sete al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_NE:
-        printf("  cmp rax, rdi\n");
-        printf("  setne al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case '<':
-        printf("  cmp rax, rdi\n");
-        printf("  setl al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_LE:
-        printf("  cmp rax, rdi\n");
-        printf("  setle al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case '>':
-        printf("  cmp rdi, rax\n");
-        printf("  setl al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_GE:
-        printf("  cmp rdi, rax\n");
-        printf("  setle al\n");
-        printf("  movzb rax, al\n");
-        break;
-    }
-
-    printf("  push rax\n");
+    gen_expr(this, context);
+    emit("  push rax\n");
+}
+
+// --instrumentのとき、計測番号probeのカウンタを1増やすコードを出力する
+static void gen_counter(int probe) {
+    if (!profile.instrument || probe < 0) return;
+    emit("  inc qword ptr [rip + __9cc_counters + %d]\n", probe * 8);
+}
+
+// 文のコードはどれも実行後にスタックへ値を1つだけ積んだ状態にする
+// （呼び出し側が必ず1回popするため）
+
+// 文の種類（名前付きラベルに使う）
+static const char *stmt_kind(Node *node) {
+    if (dynamic_cast<NodeIf *>(node)) return "if";
+    if (dynamic_cast<NodeFor *>(node)) return "for";
+    if (dynamic_cast<NodeWhile *>(node)) return "while";
+    return "stmt";
+}
+
+// -gのとき、以降の命令をlocの行に対応付ける
+static void gen_loc(GenContext& context, const char *loc) {
+    if (!context.debug || !loc) return;
+    auto pos = source_pos(loc);
+    emit("  .loc 1 %d %d\n", pos.line, pos.col);
+}
+
+// 文のコードを出力する
+// -gのときは文の先頭に名前付きラベルと.locを置き、プロファイラで文と行を対応付けられるようにする
+void gen_stmt(Node *node, GenContext& context) {
+    if (context.debug && node->loc) {
+        emit("%s:\n", context.named_label(stmt_kind(node), source_pos(node->loc)).c_str());
+        gen_loc(context, node->loc);
+    }
+    node->gen(context);
 }
 
 void NodeIf::gen(GenContext& context) {
-    cond->gen(context);
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    auto else_label = context.new_label();
-    printf("  je %s\n", else_label.c_str());
-    then->gen(context);
-    if (els) {
-        auto end_label = context.new_label();
-        printf("  jmp %s\n", end_label.c_str());
-        printf("%s:\n", else_label.c_str());
-        els->gen(context);
-        printf("%s:\n", end_label.c_str());
+    if (gen_select(this, context)) return;
+
+    auto cold_label = context.new_label();
+    auto end_label = context.new_label();
+
+    // プロファイルで多く通った方を分岐しない側に置く
+    // 少ない方が滅多に通らないなら、関数の末尾に追い出す
+    bool then_hot = profile.count(probe) >= profile.count(probe + 1);
+    auto hot = then_hot ? then : els;
+    auto cold = then_hot ? els : then;
+    int hot_probe = then_hot ? probe : probe + 1;
+    int cold_probe = then_hot ? probe + 1 : probe;
+
+    gen_branch(cond, context, !then_hot, cold_label);
+    gen_counter(hot_probe);
+    if (hot) {
+        gen_stmt(hot, context);
+    } else {
+        emit("  push rax\n");
+    }
+
+    auto gen_cold = [&context, cold, cold_probe, cold_label, end_label] {
+        emit("%s:\n", cold_label.c_str());
+        gen_counter(cold_probe);
+        if (cold) {
+            gen_stmt(cold, context);
+        } else {
+            emit("  push rax\n");
+        }
+    };
+
+    if (profile.cold(cold_probe, hot_probe)) {
+        context.defer([gen_cold, end_label] {
+            gen_cold();
+            emit("  jmp %s\n", end_label.c_str());
+        });
     } else {
-        printf("%s:\n", else_label.c_str());
+        emit("  jmp %s\n", end_label.c_str());
+        gen_cold();
     }
+    emit("%s:\n", end_label.c_str());
 }
 
 void NodeIf::gen_lval(GenContext& context) {
     error("代入の左辺値が変数ではありません");
 }
 
-void NodeFor::gen(GenContext& context) {
-    if (init) init->gen(context);
-    printf("  pop rax\n");
+// ループ本体のコードを出力する
+// プロファイルで頻繁に回っているループは条件判定を末尾に置き、
+// 1周あたりの分岐を末尾の条件分岐1つにする
+// locはループの文の位置（-gのとき、条件判定と更新式をこの行に対応付ける）
+static void gen_loop(GenContext& context, Node *cond, Node *block, Node *proc,
+                     int probe, const char *loc) {
     auto begin_label = context.new_label();
     auto end_label = context.new_label();
-    printf("%s:\n", begin_label.c_str());
-    if (cond) cond->gen(context);
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je %s\n", end_label.c_str());
-    if (block) block->gen(context);
-    printf("  pop rax\n");
-    if (proc) proc->gen(context);
-    printf("  pop rax\n");
-    printf("  jmp %s\n", begin_label.c_str());
-    printf("%s:\n", end_label.c_str());
+
+    auto gen_body = [&] {
+        if (block) {
+            gen_stmt(block, context);
+            emit("  pop rax\n");
+        }
+        if (proc) {
+            gen_loc(context, loc);
+            proc->gen(context);
+            emit("  pop rax\n");
+        }
+        gen_counter(probe);
+    };
+
+    if (profile.hot(probe)) {
+        if (cond) emit("  jmp %s\n", end_label.c_str());
+        emit("%s:\n", begin_label.c_str());
+        gen_body();
+        if (cond) {
+            emit("%s:\n", end_label.c_str());
+            gen_loc(context, loc);
+            gen_branch(cond, context, true, begin_label);
+        } else {
+            emit("  jmp %s\n", begin_label.c_str());
+        }
+    } else {
+        emit("%s:\n", begin_label.c_str());
+        if (cond) {
+            gen_loc(context, loc);
+            gen_branch(cond, context, false, end_label);
+        }
+        gen_body();
+        emit("  jmp %s\n", begin_label.c_str());
+        emit("%s:\n", end_label.c_str());
+    }
+    emit("  push rax\n");
+}
+
+void NodeFor::gen(GenContext& context) {
+    if (init) {
+        init->gen(context);
+        emit("  pop rax\n");
+    }
+    gen_loop(context, cond, block, proc, probe, loc);
 }
 
 void NodeFor::gen_lval(GenContext& context) {
@@ -176,17 +243,7 @@ void NodeFor::gen_lval(GenContext& context) {
 }
 
 void NodeWhile::gen(GenContext& context) {
-    auto begin_label = context.new_label();
-    auto end_label = context.new_label();
-    printf("%s:\n", begin_label.c_str());
-    cond->gen(context);
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je %s\n", end_label.c_str());
-    block->gen(context);
-    printf("  pop rax\n");
-    printf("  jmp %s\n", begin_label.c_str());
-    printf("%s:\n", end_label.c_str());
+    gen_loop(context, cond, block, nullptr, probe, loc);
 }
 
 void NodeWhile::gen_lval(GenContext& context) {
@@ -195,22 +252,281 @@ void NodeWhile::gen_lval(GenContext& context) {
 
 void NodeBlock::gen(GenContext& context) {
     for(auto& n: block) {
-        n->gen(context);
-        printf("  pop rax\n");
+        gen_stmt(n, context);
+        emit("  pop rax\n");
     }
 
-    printf("  push rax\n");
+    emit("  push rax\n");
 }
 
 void NodeBlock::gen_lval(GenContext& context) {
     error("代入の左辺値が変数ではありません");
 }
 
-void code_gen(std::vector<Node*>& code) {
+// System V ABIで整数引数を渡すレジスタ
+static const char *argregs[MAX_ARGS] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+void NodeCall::gen(GenContext& context) {
+    for (auto a : args) a->gen(context);
+    gen_call(name, args.size());
+}
+
+// スタックに積んだnargs個の引数で関数nameを呼び、返り値をスタックに積む
+void gen_call(const std::string& name, int nargs) {
+    for (int i = nargs - 1; i >= 0; i--) emit("  pop %s\n", argregs[i]);
+
+    // スタックの深さは実行時まで分からないので、rspを16バイト境界に
+    // 切り下げてから元のrspを積み、呼び出し後にそれを書き戻す
+    emit("  mov rax, rsp\n");
+    emit("  and rsp, -16\n");
+    emit("  sub rsp, 8\n");
+    emit("  push rax\n");
+    emit("  mov rax, 0\n");
+    emit("  call %s\n", name.c_str());
+    emit("  pop rsp\n");
+    emit("  push rax\n");
+}
+
+void NodeCall::gen_lval(GenContext& context) {
+    error("代入の左辺値が変数ではありません");
+}
+
+void NodeInline::gen(GenContext& context) {
+    for (auto a : args) a->gen(context);
+    for (int i = params.size() - 1; i >= 0; i--) {
+        emit("  pop rax\n");
+        gen_store(context, params[i], "rax");
+    }
+
+    // 本体の途中のreturnでは、ここで保存したrspに戻してから末尾へ抜ける
+    auto end_label = context.new_label();
+    if (!sp_slot.empty()) {
+        int offset = context.var_put(sp_slot);
+        emit("  mov [rbp-%d], rsp\n", offset);
+        context.inline_frames.push_back({end_label, offset});
+    }
+
+    for (auto n : body) {
+        gen_stmt(n, context);
+        emit("  pop rax\n");
+    }
+
+    if (!sp_slot.empty()) context.inline_frames.pop_back();
+    emit("%s:\n", end_label.c_str());
+    emit("  push rax\n");
+}
+
+void NodeInline::gen_lval(GenContext& context) {
+    error("代入の左辺値が変数ではありません");
+}
+
+// 呼び出された側が値を保存しなければならないレジスタ
+static bool is_callee_saved(const std::string& reg) {
+    return reg == "rbx" || reg == "r12" || reg == "r13" || reg == "r14" || reg == "r15";
+}
+
+// 変数の置き場所とエピローグのラベルを決める（コードは出力しない）
+static void setup_frame(NodeFunc *func, GenContext& context) {
+    for (auto &[var, reg] : func->reg_locals) {
+        context.regs[var] = reg;
+        if (is_callee_saved(reg)) {
+            context.current_offset += 8;
+            context.saved_regs.push_back({reg, context.current_offset});
+        }
+    }
+    for (auto &v : func->locals)
+        if (!context.reg_of(v)) context.var_put(v);
+    context.return_label = context.new_label();
+}
+
+static void gen_prologue(NodeFunc *func, GenContext& context) {
+    emit(".global %s\n", func->name.c_str());
+    emit("%s:\n", func->name.c_str());
+    gen_loc(context, func->loc);
+
+    // ローカル変数の領域を確保し、rspを16バイト境界に揃えておく
+    emit("  push rbp\n");
+    emit("  mov rbp, rsp\n");
+    emit("  sub rsp, %d\n", (context.current_offset + 15) / 16 * 16);
+    for (auto &[reg, offset] : context.saved_regs) emit("  mov [rbp-%d], %s\n", offset, reg.c_str());
+    for (size_t i = 0; i < func->params.size(); i++)
+        gen_store(context, func->params[i], argregs[i]);
+}
+
+// 最後の式の結果がRAXに残っているのでそれが返り値になる
+static void gen_epilogue(GenContext& context) {
+    emit("%s:\n", context.return_label.c_str());
+    for (auto &[reg, offset] : context.saved_regs) emit("  mov %s, [rbp-%d]\n", reg.c_str(), offset);
+    emit("  mov rsp, rbp\n");
+    emit("  pop rbp\n");
+    emit("  ret\n");
+}
+
+void NodeFunc::gen(GenContext& context) {
+    setup_frame(this, context);
+    gen_prologue(this, context);
+    for (auto n : body) {
+        gen_stmt(n, context);
+        emit("  pop rax\n");
+    }
+    gen_epilogue(context);
+
+    // 追い出したコードを出力する（その中でさらに追い出されたものも含む）
+    for (size_t i = 0; i < context.cold_blocks.size(); i++) {
+        auto gen_cold = context.cold_blocks[i];
+        gen_cold();
+    }
+}
+
+void NodeFunc::gen_lval(GenContext& context) {
+    error("代入の左辺値が変数ではありません");
+}
+
+// 並列に生成する単位（関数の本体の連続した文）
+struct GenTask {
+    NodeFunc *func;
+    size_t begin, end;      //! 生成する文の範囲（func->bodyの添字）
+    bool first, last;       //! 関数の先頭・末尾を含む（プロローグ・エピローグも出力する）
+    int func_label;         //! 関数のエピローグのラベル番号
+    int label_index;        //! 最初の文が使うラベル番号
+    int label_end;          //! 見積もったラベル番号の終わり
+    bool ok = false;        //! 見積もりどおりに生成できた
+    char *buf = nullptr;    //! 出力したアセンブリ
+    size_t size = 0;
+};
+
+// nodeのノード数と、コード生成がその中で作るラベルの数を数える
+// ラベルの数はNodeIf::gen、gen_loop、NodeInline::genのnew_labelの呼び出しと合わせること
+static void measure(Node *node, int &nodes, int &labels) {
+    std::vector<Node *> stack{node};
+    while (!stack.empty()) {
+        auto n = stack.back();
+        stack.pop_back();
+        nodes++;
+        if (auto i = dynamic_cast<NodeIf *>(n)) {
+            if (!i->branchless) labels += 2;
+        } else if (dynamic_cast<NodeFor *>(n) || dynamic_cast<NodeWhile *>(n)) {
+            labels += 2;
+        } else if (dynamic_cast<NodeInline *>(n)) {
+            labels += 1;
+        }
+        n->each_child([&](Node *&child) { stack.push_back(child); });
+    }
+}
+
+static void gen_task(GenTask &task) {
+    auto fp = open_memstream(&task.buf, &task.size);
+    if (!fp) error("メモリが足りません");
+    code_out = fp;
+
+    // 関数の変数の置き場所は先頭の文から生成したときと同じになる
     auto context = GenContext{};
+    context.label_index = task.func_label;
+    context.func_name = task.func->name;
+    setup_frame(task.func, context);
+    context.label_index = task.label_index;
+
+    if (task.first) gen_prologue(task.func, context);
+    for (size_t i = task.begin; i < task.end; i++) {
+        gen_stmt(task.func->body[i], context);
+        emit("  pop rax\n");
+    }
+    if (task.last) gen_epilogue(context);
 
-    for (auto n : code) {
-        n->gen(context);
-        printf("  pop rax\n");
+    task.ok = context.label_index == task.label_end && context.cold_blocks.empty();
+    code_out = nullptr;
+    fclose(fp);
+}
+
+// 関数の本体を文のまとまりに分け、jobs個のスレッドでそれぞれ別のバッファに生成してから
+// 順に出力する
+//
+// 生成の途中で変わる状態はラベル番号だけなので（変数の置き場所はプロローグで全て決まる）、
+// 先に各文が使うラベルの数を数えて、まとまりごとに番号の範囲を割り当てておく。
+// 見積もりが外れたら何も出力せずにfalseを返す。
+static bool gen_parallel(std::vector<NodeFunc *> &code, int jobs) {
+    std::vector<std::pair<int, int>> sizes;  // 文ごとのノード数とラベル数
+    std::vector<size_t> first_stmt;          // 関数ごとのsizesの先頭の添字
+    long total = 0;
+    for (auto f : code) {
+        first_stmt.push_back(sizes.size());
+        for (auto n : f->body) {
+            int nodes = 0, labels = 0;
+            measure(n, nodes, labels);
+            sizes.push_back({nodes, labels});
+            total += nodes;
+        }
     }
+
+    // スレッドあたり数個のまとまりになるように分ける（大きさの偏りをならすため）
+    long chunk_nodes = std::max(1L, total / (4L * jobs));
+    std::vector<GenTask> tasks;
+    int label = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        auto f = code[i];
+        int func_label = label++;
+        size_t begin = 0;
+        do {
+            GenTask task{f, begin, begin, begin == 0, false, func_label, label, label};
+            long nodes = 0;
+            while (task.end < f->body.size() && nodes < chunk_nodes) {
+                auto [n, l] = sizes[first_stmt[i] + task.end++];
+                nodes += n;
+                label += l;
+            }
+            task.label_end = label;
+            task.last = task.end == f->body.size();
+            tasks.push_back(task);
+            begin = task.end;
+        } while (begin < f->body.size());
+    }
+
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs && i < static_cast<int>(tasks.size()); i++) {
+        workers.emplace_back([&] {
+            for (size_t t; (t = next++) < tasks.size();) gen_task(tasks[t]);
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    bool ok = std::all_of(tasks.begin(), tasks.end(), [](auto &t) { return t.ok; });
+    for (auto &task : tasks) {
+        if (ok) fwrite(task.buf, 1, task.size, stdout);
+        free(task.buf);
+    }
+    // 見積もりが外れるのはmeasureとコード生成が食い違っているときなので、知らせておく
+    if (!ok) fprintf(stderr, "ラベル数の見積もりが外れたため、1スレッドで生成し直します\n");
+    return ok;
+}
+
+// debug_infoが真なら、ソースの行番号をDWARFの行番号情報（.file/.loc）として出力する
+// jobsが2以上なら、関数の本体を分けて複数のスレッドで生成する（出力は1スレッドと同じ）
+// ただし次の場合は1スレッドで生成する
+//   -g: 名前付きラベルの通し番号が関数全体の生成順で決まる
+//   プロファイルあり: 滅多に通らないコードを関数の末尾に追い出すと、
+//                     その中のラベル番号が後続の文より後に振られる
+// 複数のスレッドで生成できたら真を返す
+bool code_gen(std::vector<NodeFunc*>& code, bool debug_info, int jobs) {
+    emit(".intel_syntax noprefix\n");
+    if (debug_info) emit(".file 1 \"%s\"\n", asm_string(input_name).c_str());
+
+    if (jobs > 1 && !debug_info && !profile.loaded() && gen_parallel(code, jobs)) {
+        if (profile.instrument) gen_profile_runtime();
+        return true;
+    }
+
+    // 関数ごとに新しいGenContextを使うが、ラベル番号はファイル全体で通しにする
+    int label_index = 0;
+    for (auto f : code) {
+        auto context = GenContext{};
+        context.label_index = label_index;
+        context.debug = debug_info;
+        context.func_name = f->name;
+        f->gen(context);
+        label_index = context.label_index;
+    }
+
+    if (profile.instrument) gen_profile_runtime();
+    return false;
 }
@@ -0,0 +1,92 @@
+// コード生成の内部で共有する定義
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "9cc.hpp"
+
+// 関数1つ分のコード生成の状態
+struct GenContext {
+    std::unordered_map<std::string, int> vars;
+    int current_offset = 0;
+    int label_index = 0;
+    std::string return_label;  //! return文のジャンプ先（エピローグ）
+    std::vector<std::pair<std::string, int>> saved_regs;  //! プロローグで退避したレジスタとその位置
+    std::unordered_map<std::string, std::string> regs;  //! レジスタに置いた変数
+    bool debug = false;     //! 行番号情報と文ごとの名前付きラベルを出力する（-g）
+    std::string func_name;  //! 生成中の関数の名前
+    std::unordered_map<std::string, int> named_labels;  //! 名前付きラベルの使用回数
+
+    // 変数を置いたレジスタ（メモリ上にあればnullptr）
+    const char *reg_of(const std::string& var) {
+        auto iter = regs.find(var);
+        return iter == regs.end() ? nullptr : iter->second.c_str();
+    }
+
+    // 展開中のインライン関数（return文は一番内側の展開の末尾へ抜ける）
+    struct InlineFrame {
+        std::string end_label;  //! 展開の末尾のラベル
+        int sp_offset;          //! 展開開始時のrspを保存した変数のオフセット
+    };
+    std::vector<InlineFrame> inline_frames;
+
+    // 関数の末尾（retの後ろ）に追い出して生成する、滅多に通らないコード
+    std::vector<std::function<void()>> cold_blocks;
+
+    // genを呼ぶとその場ではなく関数の末尾にコードを出力する
+    void defer(std::function<void()> gen) {
+        auto frames = inline_frames;
+        cold_blocks.push_back([this, frames, gen] {
+            auto saved = inline_frames;
+            inline_frames = frames;
+            gen();
+            inline_frames = saved;
+        });
+    }
+
+    int var_put(const std::string& var) {
+        auto iter = vars.find(var);
+        if (iter != vars.end()) {
+            return iter->second;
+        }
+
+        current_offset += 8;
+        vars.insert({var, current_offset});
+        return current_offset;
+    }
+
+    std::string new_label() {
+        char buf[100];
+        sprintf(buf, ".Label%d", label_index++);
+        return std::string(buf);
+    }
+
+    // perfなどでシンボルとして見える、関数名・文の種類・位置から作るラベル
+    // インライン展開などで同じ文が複数回現れたら通し番号を付けて区別する
+    std::string named_label(const char *kind, SourcePos pos) {
+        auto name = func_name + "." + kind + "." + std::to_string(pos.line) + "." +
+                    std::to_string(pos.col);
+        int n = named_labels[name]++;
+        return n ? name + "." + std::to_string(n) : name;
+    }
+};
+
+// アセンブリを出力する（printfと同じ引数を取る）
+// 出力先はスレッドごとのcode_outで、nullptrなら標準出力
+extern thread_local FILE *code_out;
+void emit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+std::string asm_string(const std::string &s);
+
+void gen_stmt(Node *node, GenContext &context);
+void gen_expr(Node *node, GenContext &context);
+int expr_cost(Node *node, GenContext &context);
+std::string leaf_operand(Node *node, GenContext &context);
+std::string gen_cond(Node *cond, GenContext &context);
+void gen_branch(Node *cond, GenContext &context, bool when, const std::string &label);
+void gen_return_jump(GenContext &context);
+void gen_call(const std::string &name, int nargs);
+bool gen_select(NodeIf *node, GenContext &context);
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "9cc.hpp"
+
+// node中で代入される変数名を集める
+static void collect_assigned(Node *node, std::unordered_set<std::string> &names) {
+    if (auto n = dynamic_cast<NodeGeneral *>(node)) {
+        auto ident = dynamic_cast<NodeIdent *>(n->lhs);
+        if (n->ty == '=' && ident) names.insert(ident->name);
+    } else if (auto n = dynamic_cast<NodeInline *>(node)) {
+        for (auto &p : n->params) names.insert(p);
+    }
+    node->each_child([&](Node *&child) { collect_assigned(child, names); });
+}
+
+static bool is_commutative(int ty) {
+    return ty == '+' || ty == '*' || ty == ND_EQ || ty == ND_NE;
+}
+
+// 値番号付けによる共通部分式の削除
+//
+// 同じ演算を同じ値番号の値に施す式には同じ値番号を振り、先に計算した式が
+// 後の式を支配していれば、先の式の結果を一時変数に残して後の式をその読み出しに
+// 置き換える。構文木を制御の流れの順にたどり、if・ループの中に入るときに
+// 表の状態を覚えておき、出るときに巻き戻すことで支配関係を表す。
+struct CSE {
+    using Key = std::tuple<int, int, int>;  //! 演算の種類と両辺の値番号
+
+    struct Entry {
+        int vn;            //! 値番号
+        Node **slot;       //! 最初にこの値を計算した式の位置
+        std::string temp;  //! 結果を残す一時変数（まだ再利用していなければ空）
+    };
+
+    // 巻き戻し用の変更記録
+    struct Undo {
+        bool is_var;
+        std::string var;
+        Key key;
+        bool existed;
+        int old_vn;
+    };
+
+    NodeFunc *func;
+    int temp_index = 0;                         //! 一時変数の通し番号
+    std::unordered_map<std::string, int> vars;  //! 変数の現在の値番号
+    std::unordered_map<int, int> consts;        //! 定数の値番号
+    std::map<Key, Entry> exprs;                 //! 計算済みの式
+    std::vector<Undo> log;
+    int next_vn = 0;
+
+    explicit CSE(NodeFunc *func) : func(func) {}
+
+    size_t mark() { return log.size(); }
+    void rollback(size_t m);
+    int var(const std::string &name);
+    void set_var(const std::string &name, int vn);
+    void kill(Node *node);
+    int visit(Node *&slot, bool &pure);
+};
+
+void CSE::rollback(size_t m) {
+    while (log.size() > m) {
+        auto &u = log.back();
+        if (u.is_var) {
+            if (u.existed)
+                vars[u.var] = u.old_vn;
+            else
+                vars.erase(u.var);
+        } else {
+            exprs.erase(u.key);
+        }
+        log.pop_back();
+    }
+}
+
+int CSE::var(const std::string &name) {
+    auto iter = vars.find(name);
+    if (iter != vars.end()) return iter->second;
+
+    // まだ代入を見ていない変数（引数など）には、その時点の値として番号を振る
+    int vn = next_vn++;
+    set_var(name, vn);
+    return vn;
+}
+
+void CSE::set_var(const std::string &name, int vn) {
+    auto iter = vars.find(name);
+    bool existed = iter != vars.end();
+    log.push_back(Undo{true, name, {}, existed, existed ? iter->second : 0});
+    vars[name] = vn;
+}
+
+// node中で代入される変数は値が分からなくなるので、新しい値番号を振る
+void CSE::kill(Node *node) {
+    std::unordered_set<std::string> names;
+    collect_assigned(node, names);
+    for (auto &name : names) set_var(name, next_vn++);
+}
+
+// slotの式に値番号を振り、すでに計算済みなら一時変数の読み出しに置き換える
+// pureには式が副作用を持たないかどうかを返す
+int CSE::visit(Node *&slot, bool &pure) {
+    Node *node = slot;
+    pure = true;
+
+    if (auto n = dynamic_cast<NodeNum *>(node)) {
+        auto iter = consts.find(n->val);
+        if (iter != consts.end()) return iter->second;
+        return consts[n->val] = next_vn++;
+    }
+
+    if (auto n = dynamic_cast<NodeIdent *>(node)) return var(n->name);
+
+    if (auto n = dynamic_cast<NodeGeneral *>(node)) {
+        bool lpure = true, rpure = true;
+
+        if (n->ty == '=') {
+            int vn = visit(n->rhs, rpure);
+            auto ident = dynamic_cast<NodeIdent *>(n->lhs);
+            if (ident) set_var(ident->name, vn);
+            pure = false;
+            return vn;
+        }
+
+        if (n->ty == ND_RETURN) {
+            visit(n->lhs, lpure);
+            pure = false;
+            return next_vn++;
+        }
+
+        auto m = mark();
+        int l = visit(n->lhs, lpure);
+        int r = visit(n->rhs, rpure);
+        pure = lpure && rpure;
+
+        // a>bはb<a、a>=bはb<=aとして扱う
+        int ty = n->ty;
+        if (ty == '>') {
+            ty = '<';
+            std::swap(l, r);
+        } else if (ty == ND_GE) {
+            ty = ND_LE;
+            std::swap(l, r);
+        } else if (is_commutative(ty) && l > r) {
+            std::swap(l, r);
+        }
+
+        Key key{ty, l, r};
+        auto iter = exprs.find(key);
+        if (iter == exprs.end()) {
+            int vn = next_vn++;
+            log.push_back(Undo{false, "", key, false, 0});
+            exprs[key] = Entry{vn, &slot, ""};
+            return vn;
+        }
+
+        // 副作用のある式は取り除けないので、値番号だけ共有する
+        auto &e = iter->second;
+        if (!pure) return e.vn;
+
+        if (e.temp.empty()) {
+            e.temp = ".cse" + std::to_string(temp_index++);
+            func->locals.push_back(e.temp);
+            auto wrapped = new NodeGeneral('=', new NodeIdent(e.temp), *e.slot);
+            wrapped->loc = (*e.slot)->loc;
+            *e.slot = wrapped;
+        }
+        auto temp = e.temp;
+        int vn = e.vn;
+
+        // この式の中で記録したものは、式ごと捨てるので無効にする
+        rollback(m);
+        slot = new NodeIdent(temp);
+        slot->loc = node->loc;
+        return vn;
+    }
+
+    pure = false;
+
+    if (auto n = dynamic_cast<NodeIf *>(node)) {
+        bool p;
+        visit(n->cond, p);
+        auto m = mark();
+        visit(n->then, p);
+        rollback(m);
+        if (n->els) {
+            visit(n->els, p);
+            rollback(m);
+        }
+        kill(n->then);
+        if (n->els) kill(n->els);
+        return next_vn++;
+    }
+
+    if (auto n = dynamic_cast<NodeFor *>(node)) {
+        bool p;
+        if (n->init) visit(n->init, p);
+        // ループ中で代入される変数は、条件判定の時点で値が分からない
+        if (n->cond) kill(n->cond);
+        if (n->block) kill(n->block);
+        if (n->proc) kill(n->proc);
+        if (n->cond) visit(n->cond, p);
+        auto m = mark();
+        if (n->block) visit(n->block, p);
+        if (n->proc) visit(n->proc, p);
+        rollback(m);
+        return next_vn++;
+    }
+
+    if (auto n = dynamic_cast<NodeWhile *>(node)) {
+        bool p;
+        if (n->cond) kill(n->cond);
+        if (n->block) kill(n->block);
+        if (n->cond) visit(n->cond, p);
+        auto m = mark();
+        if (n->block) visit(n->block, p);
+        rollback(m);
+        return next_vn++;
+    }
+
+    if (auto n = dynamic_cast<NodeInline *>(node)) {
+        bool p;
+        std::vector<int> args;
+        for (auto &a : n->args) args.push_back(visit(a, p));
+
+        // 本体は途中のreturnで抜けることがあるので、出た後は何も分からないものとする
+        auto m = mark();
+        for (size_t i = 0; i < n->params.size(); i++) set_var(n->params[i], args[i]);
+        for (auto &s : n->body) visit(s, p);
+        rollback(m);
+        kill(n);
+        return next_vn++;
+    }
+
+    // 関数呼び出しやブロックは子を順にたどるだけ
+    node->each_child([&](Node *&child) {
+        bool p;
+        visit(child, p);
+    });
+    return next_vn++;
+}
+
+// 各関数で共通部分式を削除する
+void eliminate_common_subexpressions(std::vector<NodeFunc *> &code) {
+    for (auto f : code) {
+        if (too_deep(f)) continue;
+        CSE cse(f);
+        for (auto &n : f->body) {
+            bool pure;
+            cse.visit(n, pure);
+        }
+    }
+}
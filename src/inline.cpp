@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+#include "9cc.hpp"
+
+// 呼び出しの連鎖をこの深さまでは展開する
+constexpr int INLINE_MAX_DEPTH = 4;
+// プロファイルで頻繁に回っているループの中では、この倍の大きさまで展開する
+constexpr int HOT_LOOP_BUDGET_FACTOR = 4;
+
+// プロファイルで頻繁に回っているループか
+static bool is_hot_loop(Node *node) {
+    if (auto n = dynamic_cast<NodeFor *>(node)) return profile.hot(n->probe);
+    if (auto n = dynamic_cast<NodeWhile *>(node)) return profile.hot(n->probe);
+    return false;
+}
+
+// returnを含むか
+static bool has_return(Node *node) {
+    auto n = dynamic_cast<NodeGeneral *>(node);
+    if (n && n->ty == ND_RETURN) return true;
+
+    bool found = false;
+    node->each_child([&](Node *&child) { found = found || has_return(child); });
+    return found;
+}
+
+// 部分木中の変数名をrenameに従って付け替える
+static void rename_locals(Node *node,
+                          std::unordered_map<std::string, std::string> &rename) {
+    if (auto ident = dynamic_cast<NodeIdent *>(node)) {
+        ident->name = rename.at(ident->name);
+        return;
+    }
+    node->each_child([&](Node *&child) { rename_locals(child, rename); });
+}
+
+// インライン展開の状態
+struct Inliner {
+    std::unordered_map<std::string, NodeFunc *> funcs;  //! 展開前の関数の複製
+    std::unordered_map<std::string, int> sizes;         //! 展開前の関数本体のノード数
+    int budget;
+    bool report;
+    int count = 0;                   //! 展開した回数（改名した変数名の区別に使う）
+    int hot_loops = 0;               //! 囲んでいる頻繁に回るループの数
+    NodeFunc *caller = nullptr;      //! 展開先の関数
+    std::vector<std::string> chain;  //! 展開中の呼び出しの連鎖（再帰の検出用）
+
+    void run(Node *&node);
+    bool inlinable(NodeCall *call);
+    Node *expand(NodeCall *call);
+};
+
+void Inliner::run(Node *&node) {
+    bool hot = is_hot_loop(node);
+    hot_loops += hot;
+    node->each_child([&](Node *&child) { run(child); });
+    hot_loops -= hot;
+
+    auto call = dynamic_cast<NodeCall *>(node);
+    if (call && inlinable(call)) node = expand(call);
+}
+
+bool Inliner::inlinable(NodeCall *call) {
+    auto iter = funcs.find(call->name);
+    if (iter == funcs.end()) return false;  // 外部の関数
+
+    const char *reason = nullptr;
+    int size = sizes[call->name];
+    int limit = hot_loops ? budget * HOT_LOOP_BUDGET_FACTOR : budget;
+    if (iter->second->params.size() != call->args.size())
+        reason = "argument count mismatch";
+    else if (size > limit)
+        reason = "too large";
+    else if (std::find(chain.begin(), chain.end(), call->name) != chain.end())
+        reason = "recursive";
+    else if (chain.size() >= INLINE_MAX_DEPTH)
+        reason = "too deep";
+
+    if (report) {
+        if (reason)
+            fprintf(stderr, "%s: not inlined %s (%d nodes): %s\n",
+                    caller->name.c_str(), call->name.c_str(), size, reason);
+        else
+            fprintf(stderr, "%s: inlined %s (%d nodes)%s\n",
+                    caller->name.c_str(), call->name.c_str(), size,
+                    hot_loops ? " in hot loop" : "");
+    }
+    return !reason;
+}
+
+Node *Inliner::expand(NodeCall *call) {
+    auto callee = funcs[call->name];
+    auto prefix = call->name + "." + std::to_string(count++) + ".";
+
+    // 呼び出し先のローカル変数は改名して呼び出し元の変数領域に置く
+    std::unordered_map<std::string, std::string> rename;
+    for (auto &v : callee->locals) {
+        rename[v] = prefix + v;
+        caller->locals.push_back(prefix + v);
+    }
+
+    std::vector<std::string> params;
+    for (auto &p : callee->params) params.push_back(rename[p]);
+
+    std::vector<Node *> body;
+    for (auto n : callee->body) {
+        body.push_back(n->clone());
+        rename_locals(body.back(), rename);
+    }
+
+    // 末尾のreturnはただの式にしてよい
+    // それ以外にreturnが残っていれば、抜けるときのためにrspを保存する場所を用意する
+    if (!body.empty()) {
+        auto last = dynamic_cast<NodeGeneral *>(body.back());
+        if (last && last->ty == ND_RETURN) {
+            body.back() = last->lhs;
+            body.back()->loc = last->loc;
+        }
+    }
+    std::string sp_slot;
+    for (auto n : body) {
+        if (has_return(n)) {
+            sp_slot = prefix + "sp";
+            caller->locals.push_back(sp_slot);
+            break;
+        }
+    }
+
+    chain.push_back(call->name);
+    for (auto &n : body) run(n);
+    chain.pop_back();
+
+    return new NodeInline(call->name, std::move(call->args), std::move(params),
+                          std::move(body), sp_slot);
+}
+
+// 本体のノード数がbudget以下の関数の呼び出しを、呼び出し元に展開する
+// reportが真なら各呼び出し箇所で展開したかどうかを標準エラーに出力する
+void inline_functions(std::vector<NodeFunc *> &code, int budget, bool report) {
+    if (budget <= 0) return;
+
+    Inliner inliner;
+    inliner.budget = budget;
+    inliner.report = report;
+
+    // 展開中に関数本体が書き換わっても影響しないよう、展開前の状態を複製しておく
+    // 深すぎる関数は複製も展開もせず、外部の関数と同じように呼び出す
+    for (auto f : code) {
+        if (too_deep(f)) continue;
+        inliner.funcs[f->name] = static_cast<NodeFunc *>(f->clone());
+        int size = 0;
+        for (auto n : f->body) size += count_nodes(n);
+        inliner.sizes[f->name] = size;
+    }
+
+    for (auto f : code) {
+        if (too_deep(f)) continue;
+        inliner.caller = f;
+        inliner.chain = {f->name};
+        for (auto &n : f->body) inliner.run(n);
+    }
+}
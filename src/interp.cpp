@@ -0,0 +1,159 @@
+#include <csignal>
+#include <dlfcn.h>
+
+#include "bytecode.hpp"
+
+// バイトコードを9ccのプロセス内で実行するインタプリタ
+//
+// 命令をそれぞれの処理のラベルのアドレスに置き換えた列（スレッデッドコード）を
+// 先に作っておき、各処理の末尾で次の命令のラベルへ直接飛ぶ（computed goto）。
+// 命令ごとに中央のswitchへ戻らないので、分岐予測が命令の並びごとに効く。
+
+// スレッデッドコードの1命令
+struct Threaded {
+    const void *label;  //! 処理のラベルのアドレス
+    Insn insn;
+};
+
+// 呼び出し中の関数
+struct Frame {
+    const Threaded *ret;  //! 呼び出し元のCALL命令
+    size_t base;          //! 呼び出し元のレジスタ領域の先頭
+    int func;             //! 呼び出し元の関数の番号
+    int dst;              //! 呼び出し元で返り値を置くレジスタ
+};
+
+// 外部の関数はSystem V ABIで整数引数を6個までとる関数として呼ぶ
+using ExternFunc = long (*)(long, long, long, long, long, long);
+
+// 関数mainを実行し、その返り値を返す
+static long run_bytecode(const BcModule &module) {
+    static const void *labels[NUM_OPS] = {
+        &&op_mov, &&op_loadi, &&op_add, &&op_addi, &&op_sub, &&op_mul,
+        &&op_div, &&op_eq,    &&op_ne,  &&op_lt,   &&op_le,  &&op_jmp,
+        &&op_jz,  &&op_jnz,   &&op_call, &&op_callx, &&op_ret,
+    };
+
+    // スレッデッドコードを作る
+    std::vector<std::vector<Threaded>> code(module.funcs.size());
+    for (size_t i = 0; i < module.funcs.size(); i++)
+        for (auto &insn : module.funcs[i].code) code[i].push_back({labels[insn.op], insn});
+
+    // 外部の関数のアドレスを引く
+    std::vector<ExternFunc> externs;
+    for (auto &name : module.externs) {
+        auto sym = dlsym(RTLD_DEFAULT, name.c_str());
+        if (!sym) error("関数が見つかりません: %s", name.c_str());
+        externs.push_back(reinterpret_cast<ExternFunc>(sym));
+    }
+
+    // 全ての関数のレジスタ領域を1本のスタックに積む
+    std::vector<long> stack(module.funcs[module.main].num_regs);
+    std::vector<Frame> frames;
+    size_t base = 0;
+    long *r = stack.data();
+    int func = module.main;
+    const Threaded *pc = code[func].data();
+    long result;
+
+#define NEXT() goto *(++pc)->label
+#define JUMP(target) goto *(pc = code[func].data() + (target))->label
+    goto *pc->label;
+
+op_mov:
+    r[pc->insn.a] = r[pc->insn.b];
+    NEXT();
+op_loadi:
+    r[pc->insn.a] = pc->insn.imm();
+    NEXT();
+op_add:
+    // 桁あふれはネイティブの命令と同じく2の補数で折り返す
+    r[pc->insn.a] = static_cast<unsigned long>(r[pc->insn.b]) + r[pc->insn.c];
+    NEXT();
+op_addi:
+    r[pc->insn.a] = static_cast<unsigned long>(r[pc->insn.b]) + static_cast<int16_t>(pc->insn.c);
+    NEXT();
+op_sub:
+    r[pc->insn.a] = static_cast<unsigned long>(r[pc->insn.b]) - r[pc->insn.c];
+    NEXT();
+op_mul:
+    r[pc->insn.a] = static_cast<unsigned long>(r[pc->insn.b]) * r[pc->insn.c];
+    NEXT();
+op_div:
+    // ネイティブのコードはdiv命令で符号なしの除算をし、0除算ではSIGFPEで落ちる
+    if (r[pc->insn.c] == 0) raise(SIGFPE);
+    r[pc->insn.a] = static_cast<unsigned long>(r[pc->insn.b]) / r[pc->insn.c];
+    NEXT();
+op_eq:
+    r[pc->insn.a] = r[pc->insn.b] == r[pc->insn.c];
+    NEXT();
+op_ne:
+    r[pc->insn.a] = r[pc->insn.b] != r[pc->insn.c];
+    NEXT();
+op_lt:
+    r[pc->insn.a] = r[pc->insn.b] < r[pc->insn.c];
+    NEXT();
+op_le:
+    r[pc->insn.a] = r[pc->insn.b] <= r[pc->insn.c];
+    NEXT();
+op_jmp:
+    JUMP(pc->insn.imm());
+op_jz:
+    if (r[pc->insn.a] == 0) JUMP(pc->insn.imm());
+    NEXT();
+op_jnz:
+    if (r[pc->insn.a] != 0) JUMP(pc->insn.imm());
+    NEXT();
+
+op_call: {
+    // 呼び出し元のレジスタ領域の後ろに呼び出し先の領域を確保する
+    auto &insn = pc->insn;
+    auto &callee = module.funcs[insn.c];
+    size_t next = base + module.funcs[func].num_regs;
+    frames.push_back({pc, base, func, insn.a});
+
+    if (stack.size() < next + callee.num_regs) stack.resize(next + callee.num_regs);
+    long *args = stack.data() + base + insn.a;
+    r = stack.data() + next;
+    for (int i = 0; i < callee.num_regs; i++)
+        r[i] = i < insn.b && i < callee.num_params ? args[i] : 0;
+
+    base = next;
+    func = insn.c;
+    pc = code[func].data();
+    goto *pc->label;
+}
+op_callx: {
+    auto &insn = pc->insn;
+    long a[MAX_ARGS] = {};
+    for (int i = 0; i < insn.b && i < MAX_ARGS; i++) a[i] = r[insn.a + i];
+    r[insn.a] = externs[insn.c](a[0], a[1], a[2], a[3], a[4], a[5]);
+    NEXT();
+}
+op_ret: {
+    long value = r[pc->insn.a];
+    if (frames.empty()) {
+        result = value;
+        goto done;
+    }
+    auto caller = frames.back();
+    frames.pop_back();
+    func = caller.func;
+    base = caller.base;
+    r = stack.data() + base;
+    r[caller.dst] = value;
+    pc = caller.ret;
+    NEXT();
+}
+
+done:
+#undef NEXT
+#undef JUMP
+    return result;
+}
+
+int interpret(std::vector<NodeFunc *> &code) {
+    auto module = compile_bytecode(code);
+    if (module.main < 0) error("main関数がありません");
+    return run_bytecode(module);
+}
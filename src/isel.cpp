@@ -0,0 +1,566 @@
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <unordered_map>
+
+#include "9cc.hpp"
+#include "codegen.hpp"
+
+// 木パターン照合による命令選択
+//
+// 式の木の各ノードについて、値をどの形で用意できるか（非終端記号）ごとに、
+// 最小のコストとそのときに使う規則を下から順に求める（ラベル付け）。
+// そのあと根から、選んだ規則に従って命令を出力する（還元）。
+// 即値・メモリ・レジスタをx86の命令のオペランドに直接書けるので、
+// スタックを経由せずに済む。
+
+// 値の置き場所（非終端記号）
+enum NT {
+    NT_REG,   //! raxに計算済みの値
+    NT_IMM,   //! 即値（定数）
+    NT_MEM,   //! スタック上の変数 [rbp-N]
+    NT_VREG,  //! レジスタに置いた変数
+    NUM_NT,
+};
+
+constexpr int INF = INT_MAX / 4;
+
+// 比較演算をまとめて扱うための演算の種類
+constexpr int OP_CMP = -1;
+
+static int op_class(int ty) {
+    switch (ty) {
+    case ND_EQ:
+    case ND_NE:
+    case '<':
+    case ND_LE:
+    case '>':
+    case ND_GE:
+        return OP_CMP;
+    }
+    return ty;
+}
+
+static bool is_commutative(int ty) {
+    return ty == '+' || ty == '*' || ty == ND_EQ || ty == ND_NE;
+}
+
+// 比較演算に対応する条件コード
+static const char *cond_code(int ty) {
+    switch (ty) {
+    case ND_EQ: return "e";
+    case ND_NE: return "ne";
+    case '<': return "l";
+    case ND_LE: return "le";
+    case '>': return "g";
+    case ND_GE: return "ge";
+    }
+    return nullptr;
+}
+
+// 両辺を入れ替えたときの比較演算
+static int swap_cmp(int ty) {
+    switch (ty) {
+    case '<': return '>';
+    case ND_LE: return ND_GE;
+    case '>': return '<';
+    case ND_GE: return ND_LE;
+    }
+    return ty;
+}
+
+// 代入を含むか（含まなければ評価順を入れ替えても結果が変わらない）
+static bool has_assign(Node *node) {
+    auto n = dynamic_cast<NodeGeneral *>(node);
+    if (n && n->ty == '=') return true;
+
+    bool found = false;
+    node->each_child([&](Node *&child) { found = found || has_assign(child); });
+    return found;
+}
+
+// nodeが即値で、その値がvalか
+static bool imm_is(Node *node, int val) {
+    auto n = dynamic_cast<NodeNum *>(node);
+    return n && n->val == val;
+}
+
+// 即値のノードの値（規則が即値と決まったオペランドにだけ使う）
+static int imm_of(Node *node) { return static_cast<NodeNum *>(node)->val; }
+
+static bool is_pow2(int v) { return v > 0 && (v & (v - 1)) == 0; }
+
+static int log2_of(int v) {
+    int n = 0;
+    while (v >>= 1) n++;
+    return n;
+}
+
+struct Selector;
+struct Rule;
+
+// ノードごとのラベル付けの結果
+struct Label {
+    int cost[NUM_NT];
+    const Rule *rule;  //! NT_REGを作る規則（葉ならnullptr）
+};
+
+struct Rule {
+    const char *name;
+    int op;     //! 演算の種類（比較はOP_CMP）
+    NT lhs;
+    NT rhs;
+    int cost;
+    bool (*pred)(NodeGeneral *);           //! 追加の条件（nullptrなら常に適用可）
+    void (*emit)(Selector &, NodeGeneral *);
+};
+
+struct Selector {
+    GenContext &context;
+    std::unordered_map<Node *, Label> labels;
+    Node *branch_root = nullptr;  //! 比較結果をフラグに残すだけでよい根
+    std::string cc;               //! branch_rootの比較で成り立つ条件コード
+
+    explicit Selector(GenContext &context) : context(context) {}
+
+    const Label &label(Node *node);
+    void reduce(Node *node);
+    void reduce_deep(Node *root);
+    void reduce_any(Node *node);
+    void apply(NodeGeneral *node, int ty, const std::string &src, bool src_is_imm);
+    void set_cond(NodeGeneral *node, int ty);
+};
+
+// 葉のノード（数か変数）を命令のオペランドとして書いたもの
+std::string leaf_operand(Node *node, GenContext &context) {
+    if (auto n = dynamic_cast<NodeNum *>(node)) return std::to_string(n->val);
+
+    auto ident = static_cast<NodeIdent *>(node);
+    if (auto reg = context.reg_of(ident->name)) return reg;
+    return "qword ptr [rbp-" + std::to_string(context.var_put(ident->name)) + "]";
+}
+
+// raxに対して演算tyをオペランドsrcで行う
+void Selector::apply(NodeGeneral *node, int ty, const std::string &src, bool src_is_imm) {
+    switch (ty) {
+    case '+':
+        emit("  add rax, %s\n", src.c_str());
+        return;
+    case '-':
+        emit("  sub rax, %s\n", src.c_str());
+        return;
+    case '*':
+        if (src_is_imm) {
+            emit("  imul rax, rax, %s\n", src.c_str());
+        } else {
+            emit("  imul rax, %s\n", src.c_str());
+        }
+        return;
+    case '/':
+        if (src_is_imm) {
+            emit("  mov rdi, %s\n", src.c_str());
+            emit("  mov rdx, 0\n");
+            emit("  div rdi\n");
+        } else {
+            emit("  mov rdx, 0\n");
+            emit("  div %s\n", src.c_str());
+        }
+        return;
+    }
+
+    emit("  cmp rax, %s\n", src.c_str());
+    set_cond(node, ty);
+}
+
+// 直前の比較の結果を、分岐に使うならそのまま残し、そうでなければ0か1にしてraxに置く
+void Selector::set_cond(NodeGeneral *node, int ty) {
+    if (node == branch_root) {
+        cc = cond_code(ty);
+        return;
+    }
+    emit("  set%s al\n", cond_code(ty));
+    emit("  movzb rax, al\n");
+}
+
+// 規則の出力部分
+
+// op(REG, 葉): 左辺をraxに計算し、右辺をオペランドに書く
+static void emit_leaf(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->lhs);
+    sel.apply(n, n->ty, leaf_operand(n->rhs, sel.context),
+              dynamic_cast<NodeNum *>(n->rhs) != nullptr);
+}
+
+// op(REG, REG): 左辺をスタックに退避して右辺を計算する
+static void emit_stack(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->lhs);
+    emit("  push rax\n");
+    sel.reduce(n->rhs);
+    emit("  mov rdi, rax\n");
+    emit("  pop rax\n");
+    sel.apply(n, n->ty, "rdi", false);
+}
+
+// op(葉, REG)で交換法則が成り立つ: 右辺をraxに計算し、左辺をオペランドに書く
+static void emit_commuted(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->rhs);
+    int ty = op_class(n->ty) == OP_CMP ? swap_cmp(n->ty) : n->ty;
+    sel.apply(n, ty, leaf_operand(n->lhs, sel.context),
+              dynamic_cast<NodeNum *>(n->lhs) != nullptr);
+}
+
+// op(葉, REG): 右辺を先に計算し、rdiに移してから左辺を読む
+static void emit_reversed(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->rhs);
+    emit("  mov rdi, rax\n");
+    sel.reduce(n->lhs);
+    sel.apply(n, n->ty, "rdi", false);
+}
+
+// cmp(レジスタ変数, 葉): raxを経由せずに比較する
+static void emit_cmp_vreg(Selector &sel, NodeGeneral *n) {
+    emit("  cmp %s, %s\n", leaf_operand(n->lhs, sel.context).c_str(),
+         leaf_operand(n->rhs, sel.context).c_str());
+    sel.set_cond(n, n->ty);
+}
+
+static void emit_inc(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->lhs);
+    emit("  %s rax\n", n->ty == '+' ? "inc" : "dec");
+}
+
+static void emit_neg(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->rhs);
+    emit("  neg rax\n");
+}
+
+static void emit_shift(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->lhs);
+    emit("  %s rax, %d\n", n->ty == '*' ? "shl" : "shr", log2_of(imm_of(n->rhs)));
+}
+
+static void emit_lea(Selector &sel, NodeGeneral *n) {
+    emit("  lea rax, [%s + %s]\n", leaf_operand(n->lhs, sel.context).c_str(),
+         leaf_operand(n->rhs, sel.context).c_str());
+}
+
+// 代入: 右辺をraxに計算して変数に書き込む
+static void emit_assign(Selector &sel, NodeGeneral *n) {
+    sel.reduce(n->rhs);
+    emit("  mov %s, rax\n", leaf_operand(n->lhs, sel.context).c_str());
+}
+
+// 左辺が変数でない代入（gen_lvalがエラーにする）
+static void emit_assign_lval(Selector &sel, NodeGeneral *n) {
+    n->lhs->gen_lval(sel.context);
+    sel.reduce(n->rhs);
+    emit("  pop rdi\n");
+    emit("  mov [rdi], rax\n");
+}
+
+// x = x op 葉: 変数を直接書き換える
+static void emit_update(Selector &sel, NodeGeneral *n) {
+    auto rhs = static_cast<NodeGeneral *>(n->rhs);
+    auto var = leaf_operand(n->lhs, sel.context);
+    auto src = leaf_operand(rhs->rhs, sel.context);
+    bool one = imm_is(rhs->rhs, 1);
+
+    if (one && rhs->ty != '*') {
+        emit("  %s %s\n", rhs->ty == '+' ? "inc" : "dec", var.c_str());
+    } else if (rhs->ty == '*') {
+        emit("  imul %s, %s\n", var.c_str(), src.c_str());
+    } else {
+        emit("  %s %s, %s\n", rhs->ty == '+' ? "add" : "sub", var.c_str(), src.c_str());
+    }
+    emit("  mov rax, %s\n", var.c_str());
+}
+
+// 規則の適用条件
+// オペランドのコストを確かめる前に呼ばれるので、即値かどうかも自分で確かめる
+
+static bool rhs_is_one(NodeGeneral *n) { return imm_is(n->rhs, 1); }
+static bool lhs_is_zero(NodeGeneral *n) { return imm_is(n->lhs, 0); }
+static bool rhs_is_pow2(NodeGeneral *n) {
+    auto imm = dynamic_cast<NodeNum *>(n->rhs);
+    return imm && is_pow2(imm->val);
+}
+static bool rhs_no_assign(NodeGeneral *n) { return !has_assign(n->rhs); }
+static bool commutable(NodeGeneral *n) {
+    return (is_commutative(n->ty) || op_class(n->ty) == OP_CMP) && !has_assign(n->rhs);
+}
+
+// x = x op y（opは+ - *、yは即値か変数）
+static bool is_update(NodeGeneral *n) {
+    auto var = dynamic_cast<NodeIdent *>(n->lhs);
+    auto rhs = dynamic_cast<NodeGeneral *>(n->rhs);
+    if (!var || !rhs || (rhs->ty != '+' && rhs->ty != '-' && rhs->ty != '*')) return false;
+
+    auto x = dynamic_cast<NodeIdent *>(rhs->lhs);
+    if (!x || x->name != var->name) return false;
+    return dynamic_cast<NodeNum *>(rhs->rhs) || dynamic_cast<NodeIdent *>(rhs->rhs);
+}
+
+// メモリ上の変数を直接書き換えるのは即値の加減算だけ
+// （imulはメモリを書き換え先にできない）
+static bool is_update_mem(NodeGeneral *n) {
+    return is_update(n) && static_cast<NodeGeneral *>(n->rhs)->ty != '*' &&
+           dynamic_cast<NodeNum *>(static_cast<NodeGeneral *>(n->rhs)->rhs);
+}
+
+// 規則の表
+// コストはおおよその命令数（メモリアクセスを伴うものは重く、
+// スタックへの退避を伴うものはさらに重くする）
+static const Rule rules[] = {
+    // 加算
+    {"add r,imm",   '+', NT_REG,  NT_IMM,  2, nullptr, emit_leaf},
+    {"inc r",       '+', NT_REG,  NT_IMM,  1, rhs_is_one, emit_inc},
+    {"add r,mem",   '+', NT_REG,  NT_MEM,  3, nullptr, emit_leaf},
+    {"add r,vreg",  '+', NT_REG,  NT_VREG, 2, nullptr, emit_leaf},
+    {"add r,r",     '+', NT_REG,  NT_REG,  6, nullptr, emit_stack},
+    {"add imm,r",   '+', NT_IMM,  NT_REG,  2, commutable, emit_commuted},
+    {"add mem,r",   '+', NT_MEM,  NT_REG,  3, commutable, emit_commuted},
+    {"add vreg,r",  '+', NT_VREG, NT_REG,  2, commutable, emit_commuted},
+    {"lea vreg+imm", '+', NT_VREG, NT_IMM,  2, nullptr, emit_lea},
+    {"lea vreg+vreg", '+', NT_VREG, NT_VREG, 2, nullptr, emit_lea},
+
+    // 減算
+    {"sub r,imm",   '-', NT_REG,  NT_IMM,  2, nullptr, emit_leaf},
+    {"dec r",       '-', NT_REG,  NT_IMM,  1, rhs_is_one, emit_inc},
+    {"sub r,mem",   '-', NT_REG,  NT_MEM,  3, nullptr, emit_leaf},
+    {"sub r,vreg",  '-', NT_REG,  NT_VREG, 2, nullptr, emit_leaf},
+    {"sub r,r",     '-', NT_REG,  NT_REG,  6, nullptr, emit_stack},
+    {"neg r",       '-', NT_IMM,  NT_REG,  1, lhs_is_zero, emit_neg},
+    {"sub imm,r",   '-', NT_IMM,  NT_REG,  4, rhs_no_assign, emit_reversed},
+    {"sub mem,r",   '-', NT_MEM,  NT_REG,  4, rhs_no_assign, emit_reversed},
+    {"sub vreg,r",  '-', NT_VREG, NT_REG,  4, rhs_no_assign, emit_reversed},
+
+    // 乗算
+    {"imul r,imm",  '*', NT_REG,  NT_IMM,  2, nullptr, emit_leaf},
+    {"shl r",       '*', NT_REG,  NT_IMM,  1, rhs_is_pow2, emit_shift},
+    {"imul r,mem",  '*', NT_REG,  NT_MEM,  3, nullptr, emit_leaf},
+    {"imul r,vreg", '*', NT_REG,  NT_VREG, 2, nullptr, emit_leaf},
+    {"imul r,r",    '*', NT_REG,  NT_REG,  6, nullptr, emit_stack},
+    {"imul imm,r",  '*', NT_IMM,  NT_REG,  2, commutable, emit_commuted},
+    {"imul mem,r",  '*', NT_MEM,  NT_REG,  3, commutable, emit_commuted},
+    {"imul vreg,r", '*', NT_VREG, NT_REG,  2, commutable, emit_commuted},
+
+    // 除算（符号なし）
+    {"div r,imm",   '/', NT_REG,  NT_IMM,  5, nullptr, emit_leaf},
+    {"shr r",       '/', NT_REG,  NT_IMM,  1, rhs_is_pow2, emit_shift},
+    {"div r,mem",   '/', NT_REG,  NT_MEM,  5, nullptr, emit_leaf},
+    {"div r,vreg",  '/', NT_REG,  NT_VREG, 4, nullptr, emit_leaf},
+    {"div r,r",     '/', NT_REG,  NT_REG,  8, nullptr, emit_stack},
+    {"div imm,r",   '/', NT_IMM,  NT_REG,  6, rhs_no_assign, emit_reversed},
+    {"div mem,r",   '/', NT_MEM,  NT_REG,  6, rhs_no_assign, emit_reversed},
+    {"div vreg,r",  '/', NT_VREG, NT_REG,  6, rhs_no_assign, emit_reversed},
+
+    // 比較
+    {"cmp r,imm",   OP_CMP, NT_REG,  NT_IMM,  3, nullptr, emit_leaf},
+    {"cmp r,mem",   OP_CMP, NT_REG,  NT_MEM,  4, nullptr, emit_leaf},
+    {"cmp r,vreg",  OP_CMP, NT_REG,  NT_VREG, 3, nullptr, emit_leaf},
+    {"cmp r,r",     OP_CMP, NT_REG,  NT_REG,  7, nullptr, emit_stack},
+    {"cmp vreg,imm", OP_CMP, NT_VREG, NT_IMM,  2, nullptr, emit_cmp_vreg},
+    {"cmp vreg,mem", OP_CMP, NT_VREG, NT_MEM,  3, nullptr, emit_cmp_vreg},
+    {"cmp vreg,vreg", OP_CMP, NT_VREG, NT_VREG, 2, nullptr, emit_cmp_vreg},
+    {"cmp imm,r",   OP_CMP, NT_IMM,  NT_REG,  3, commutable, emit_commuted},
+    {"cmp mem,r",   OP_CMP, NT_MEM,  NT_REG,  4, commutable, emit_commuted},
+    {"cmp vreg,r",  OP_CMP, NT_VREG, NT_REG,  3, commutable, emit_commuted},
+
+    // 代入
+    {"mov vreg,r",  '=', NT_VREG, NT_REG, 1, nullptr, emit_assign},
+    {"mov mem,r",   '=', NT_MEM,  NT_REG, 2, nullptr, emit_assign},
+    {"op vreg,src", '=', NT_VREG, NT_REG, 2, is_update, emit_update},
+    {"op mem,imm",  '=', NT_MEM,  NT_REG, 4, is_update_mem, emit_update},
+    {"mov [r],r",   '=', NT_REG,  NT_REG, 8, nullptr, emit_assign_lval},
+};
+
+// 代入規則の中で、右辺のラベルを使わず自分で木を読むもの
+static bool covers_rhs(const Rule &r) { return r.emit == emit_update; }
+
+// 式でないノード（関数呼び出しなど）をraxに計算するコスト
+constexpr int FALLBACK_COST = 4;
+
+const Label &Selector::label(Node *node) {
+    auto iter = labels.find(node);
+    if (iter != labels.end()) return iter->second;
+
+    Label l;
+    for (auto &c : l.cost) c = INF;
+    l.rule = nullptr;
+
+    if (dynamic_cast<NodeNum *>(node)) {
+        l.cost[NT_IMM] = 0;
+        l.cost[NT_REG] = 1;
+    } else if (auto n = dynamic_cast<NodeIdent *>(node)) {
+        if (context.reg_of(n->name)) {
+            l.cost[NT_VREG] = 0;
+            l.cost[NT_REG] = 1;
+        } else {
+            l.cost[NT_MEM] = 0;
+            l.cost[NT_REG] = 2;
+        }
+    } else if (auto n = dynamic_cast<NodeGeneral *>(node); n && n->ty != ND_RETURN) {
+        auto &lhs = label(n->lhs);
+        auto &rhs = label(n->rhs);
+        int op = op_class(n->ty);
+
+        for (auto &r : rules) {
+            if (r.op != op) continue;
+            if (r.op == '=' && r.lhs != NT_REG && lhs.cost[r.lhs] != 0) continue;
+            if (r.pred && !r.pred(n)) continue;
+
+            int cost = r.cost;
+            if (covers_rhs(r)) {
+                // 右辺は規則が直接読むので、右辺のラベルは使わない
+            } else if (r.op == '=') {
+                cost += rhs.cost[r.rhs];
+            } else {
+                if (lhs.cost[r.lhs] >= INF || rhs.cost[r.rhs] >= INF) continue;
+                cost += lhs.cost[r.lhs] + rhs.cost[r.rhs];
+            }
+            if (cost < l.cost[NT_REG]) {
+                l.cost[NT_REG] = cost;
+                l.rule = &r;
+            }
+        }
+    } else {
+        l.cost[NT_REG] = FALLBACK_COST;
+    }
+
+    return labels[node] = l;
+}
+
+// nodeの値をraxに計算する
+void Selector::reduce(Node *node) {
+    auto &l = label(node);
+
+    if (l.rule) {
+        l.rule->emit(*this, static_cast<NodeGeneral *>(node));
+        return;
+    }
+
+    if (l.cost[NT_IMM] == 0 || l.cost[NT_VREG] == 0 || l.cost[NT_MEM] == 0) {
+        emit("  mov rax, %s\n", leaf_operand(node, context).c_str());
+        return;
+    }
+
+    // 命令選択の対象でないノードはスタックに積む従来のコード生成に任せる
+    node->gen(context);
+    emit("  pop rax\n");
+}
+
+// 深すぎる式をraxに計算する
+//
+// ラベル付けと還元は式の深さだけ再帰するので、深い部分は従来のスタックマシンの
+// コードを作業スタックを使って再帰せずに出力し、深さがMAX_OPT_DEPTH以下の
+// 部分木だけを命令選択に任せる。
+void Selector::reduce_deep(Node *root) {
+    // 各部分木の高さを帰りがけ順に求める
+    std::unordered_map<Node *, int> height;
+    std::vector<std::pair<Node *, bool>> stack{{root, false}};
+    while (!stack.empty()) {
+        auto [node, visited] = stack.back();
+        stack.pop_back();
+        if (visited) {
+            int h = 0;
+            node->each_child([&](Node *&child) { h = std::max(h, height[child]); });
+            height[node] = h + 1;
+            continue;
+        }
+        stack.push_back({node, true});
+        node->each_child([&](Node *&child) { stack.push_back({child, false}); });
+    }
+
+    // 各ノードの値をスタックに積むコードを出力する
+    // 子を積み終えたら（visitedが真で取り出したら）自分の演算を出力する
+    stack.push_back({root, false});
+    while (!stack.empty()) {
+        auto [node, visited] = stack.back();
+        stack.pop_back();
+
+        auto n = dynamic_cast<NodeGeneral *>(node);
+        auto call = dynamic_cast<NodeCall *>(node);
+        if (height[node] <= MAX_OPT_DEPTH || (!n && !call)) {
+            reduce(node);
+            emit("  push rax\n");
+            continue;
+        }
+
+        if (!visited) {
+            stack.push_back({node, true});
+            if (call) {
+                for (auto iter = call->args.rbegin(); iter != call->args.rend(); ++iter)
+                    stack.push_back({*iter, false});
+            } else {
+                stack.push_back({n->rhs, false});
+                if (n->ty != '=') stack.push_back({n->lhs, false});
+            }
+            continue;
+        }
+
+        if (call) {
+            gen_call(call->name, call->args.size());
+            continue;
+        }
+
+        if (n->ty == '=') {
+            if (!dynamic_cast<NodeIdent *>(n->lhs)) n->lhs->gen_lval(context);
+            emit("  pop rax\n");
+            emit("  mov %s, rax\n", leaf_operand(n->lhs, context).c_str());
+            emit("  push rax\n");
+            continue;
+        }
+
+        emit("  pop rdi\n");
+        emit("  pop rax\n");
+        apply(n, n->ty, "rdi", false);
+        emit("  push rax\n");
+    }
+    emit("  pop rax\n");
+}
+
+// 式の深さに応じて命令選択か再帰しないコード生成を使い分ける
+void Selector::reduce_any(Node *node) {
+    if (deeper_than(node, MAX_OPT_DEPTH)) {
+        reduce_deep(node);
+    } else {
+        reduce(node);
+    }
+}
+
+void gen_expr(Node *node, GenContext &context) {
+    Selector sel(context);
+    sel.reduce_any(node);
+}
+
+// nodeをraxに計算する命令列のおおよそのコスト
+int expr_cost(Node *node, GenContext &context) {
+    Selector sel(context);
+    return sel.label(node).cost[NT_REG];
+}
+
+// condを評価してフラグに結果を残し、condが真のとき成り立つ条件コードを返す
+// 比較演算ならsetccを使わず、比較結果のフラグをそのまま使う
+std::string gen_cond(Node *cond, GenContext &context) {
+    Selector sel(context);
+    auto n = dynamic_cast<NodeGeneral *>(cond);
+    if (n && op_class(n->ty) == OP_CMP) sel.branch_root = cond;
+
+    sel.reduce_any(cond);
+    if (sel.cc.empty()) {
+        emit("  cmp rax, 0\n");
+        sel.cc = "ne";
+    }
+    return sel.cc;
+}
+
+// condの値が真（0以外）かどうかがwhenに一致すればlabelへ分岐する
+void gen_branch(Node *cond, GenContext &context, bool when, const std::string &label) {
+    auto cc = gen_cond(cond, context);
+    if (!when) {
+        static const std::unordered_map<std::string, std::string> negate = {
+            {"e", "ne"}, {"ne", "e"}, {"l", "ge"}, {"ge", "l"}, {"le", "g"}, {"g", "le"}};
+        cc = negate.at(cc);
+    }
+    emit("  j%s %s\n", cc.c_str(), label.c_str());
+}
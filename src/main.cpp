@@ -1,34 +1,145 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 
 #include "9cc.hpp"
 
+// --jobsで指定できるスレッド数の上限
+constexpr long MAX_JOBS = 1024;
+
+// --inline-budgetで指定できる上限（ホットなループ内で何倍かしてもintに収まるように）
+constexpr long MAX_INLINE_BUDGET = 1000000;
+
+// ファイルの内容を全て読み込む
+static std::string read_file(const char *path) {
+    std::ifstream ifs(path);
+    if (!ifs) error("ファイルを開けません: %s", path);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+// FNV-1aハッシュ
+static unsigned long hash_string(const char *s) {
+    unsigned long h = 14695981039346656037UL;
+    for (; *s; s++) {
+        h ^= static_cast<unsigned char>(*s);
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "使い方: 9cc [オプション] <プログラム>\n"
+            "        9cc [オプション] -f <ファイル>\n"
+            "        9cc [オプション] --load-ast=<ファイル>\n"
+            "  -O0                最適化しない\n"
+            "  -g                 行番号情報と文ごとの名前付きラベルを出力する\n"
+            "  --inline-budget=N  本体がNノード以下の関数をインライン展開する"
+            "（%ld以下、0で無効、既定値%d）\n"
+            "  --inline-report    インライン展開の結果を標準エラーに出力する\n"
+            "  --instrument[=F]   分岐とループの実行回数を数え、終了時にF"
+            "（既定値9cc.prof）へ書き出す\n"
+            "  --profile-use=F    --instrumentで得た実行回数を使って最適化する\n"
+            "  --interpret        アセンブリを出力せず、バイトコードに変換してその場で実行する\n"
+            "  --emit-ast=F       パースした構文木をFに書き出す（翻訳はそのまま続ける）\n"
+            "  --load-ast=F       ソースの代わりに--emit-astで書き出した構文木を読み込む\n"
+            "  --jobs=N           N個（%ld以下）のスレッドでアセンブリを生成する"
+            "（出力は1スレッドと同じ）\n",
+            MAX_INLINE_BUDGET, DEFAULT_INLINE_BUDGET, MAX_JOBS);
+    exit(1);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "引数の個数が正しくありません\n");
-        return 1;
+    std::string source;
+    bool has_source = false;
+    bool optimize = true;
+    int inline_budget = DEFAULT_INLINE_BUDGET;
+    bool inline_report = false;
+    const char *profile_use = nullptr;
+    bool interpret_mode = false;
+    bool debug_info = false;
+    const char *emit_ast = nullptr;
+    const char *load_ast_path = nullptr;
+    int jobs = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-f") == 0) {
+            // -f <file>: プログラムをファイルから読み込む
+            if (has_source || ++i == argc) usage();
+            source = read_file(argv[i]);
+            input_name = argv[i];
+            has_source = true;
+        } else if (strcmp(arg, "-O0") == 0) {
+            optimize = false;
+        } else if (strcmp(arg, "-O1") == 0) {
+            optimize = true;
+        } else if (strcmp(arg, "-g") == 0) {
+            debug_info = true;
+        } else if (strncmp(arg, "--inline-budget=", 16) == 0) {
+            char *end;
+            long n = strtol(arg + 16, &end, 10);
+            if (end == arg + 16 || *end || n < 0 || n > MAX_INLINE_BUDGET) usage();
+            inline_budget = n;
+        } else if (strcmp(arg, "--inline-report") == 0) {
+            inline_report = true;
+        } else if (strcmp(arg, "--instrument") == 0) {
+            profile.instrument = true;
+            profile.path = "9cc.prof";
+        } else if (strncmp(arg, "--instrument=", 13) == 0) {
+            profile.instrument = true;
+            profile.path = arg + 13;
+        } else if (strncmp(arg, "--profile-use=", 14) == 0) {
+            profile_use = arg + 14;
+        } else if (strcmp(arg, "--interpret") == 0) {
+            interpret_mode = true;
+        } else if (strncmp(arg, "--jobs=", 7) == 0) {
+            char *end;
+            long n = strtol(arg + 7, &end, 10);
+            if (end == arg + 7 || *end || n < 1 || n > MAX_JOBS) usage();
+            jobs = n;
+        } else if (strncmp(arg, "--emit-ast=", 11) == 0) {
+            emit_ast = arg + 11;
+        } else if (strncmp(arg, "--load-ast=", 11) == 0) {
+            if (has_source) usage();
+            load_ast_path = arg + 11;
+            has_source = true;
+        } else {
+            if (has_source) usage();
+            source = arg;
+            has_source = true;
+        }
     }
+    if (!has_source) usage();
+    if (interpret_mode && profile.instrument) error("--interpretと--instrumentは同時に使えません");
 
-    // トークナイズしてパースする
-    tokenize(argv[1]);
-    std::vector<Node *> code = parse();
+    std::vector<NodeFunc *> code;
+    if (load_ast_path) {
+        // パース済みの構文木を読み込む（ソースもファイルに入っている）
+        code = load_ast(load_ast_path);
+    } else {
+        // トークナイズしてパースする
+        // エラーがあっても最後までパースし、見つかったエラーをまとめて表示する
+        tokenize(source.c_str());
+        code = parse();
+        if (report_diagnostics() > 0) return 1;
+        if (emit_ast) save_ast(emit_ast, code);
+    }
 
-    // アセンブリの前半部分を出力
-    printf(".intel_syntax noprefix\n");
-    printf(".global main\n");
-    printf("main:\n");
+    // 計測番号はインライン展開の前に振り、展開された複製も同じカウンタを使う
+    profile.hash = hash_string(user_input);
+    assign_probes(code);
+    if (profile_use && !load_profile(profile_use)) return 1;
 
-    // プロローグ
-    // 変数26個分の領域を確保する
-    printf("  push rbp\n");
-    printf("  mov rbp, rsp\n");
-    printf("  sub rsp, 208\n");
+    if (optimize) run_optimizations(code, inline_budget, inline_report);
 
-    code_gen(code);
+    // インタプリタではプログラムの返り値がそのまま終了コードになる
+    if (interpret_mode) return interpret(code);
 
-    // エピローグ
-    // 最後の式の結果がRAXに残っているのでそれが返り値になる
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");
-    printf("  ret\n");
+    code_gen(code, debug_info, jobs);
     return 0;
 }
@@ -0,0 +1,10 @@
+#include "9cc.hpp"
+
+// -O1の最適化をかける（9ccとテストで同じ順序を使う）
+// 計測番号（assign_probes）は展開された複製も同じカウンタを使うよう、先に振っておくこと
+void run_optimizations(std::vector<NodeFunc *> &code, int inline_budget, bool inline_report) {
+    inline_functions(code, inline_budget, inline_report);
+    eliminate_common_subexpressions(code);
+    promote_locals(code);
+    select_branchless(code);
+}
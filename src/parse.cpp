@@ -1,5 +1,7 @@
 #include "9cc.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 
 static int pos;
@@ -39,6 +41,14 @@ Node *new_node_block(std::vector<Node*>&& block) {
     return new NodeBlock(std::move(block));
 }
 
+Node *new_node_call(const std::string &name, std::vector<Node*>&& args) {
+    return new NodeCall(name, std::move(args));
+}
+
+NodeFunc *new_node_func(const std::string &name, std::vector<std::string>&& params) {
+    return new NodeFunc(name, std::move(params));
+}
+
 int consume(int ty) {
     if (tokens[pos].ty != ty) return 0;
     pos++;
@@ -46,19 +56,21 @@ int consume(int ty) {
 }
 
 Node *stmt();
+static Node *parse_stmt();
 Node *assign();
 Node *equality();
 Node *relational();
 Node *add();
 Node *mul();
-Node *term();
-Node *unary();
 
 /// syntax
 ///
-/// program: stmt program;
+/// program: funcdef program
+/// program: stmt program
 /// program: ε
 ///
+/// funcdef: ident "(" [ident ("," ident)*] ")" "{" stmt_list "}"
+///
 /// stmt: "{" stmt_list "}"
 /// stmt: "return" assign ";"
 /// stmt: assign ";"
@@ -74,51 +86,166 @@ Node *unary();
 ///
 /// whileclause: "while" "(" assign ")" stmt
 ///
-/// assign: equality
-/// assign: equality "=" assign
+/// assign: expr(BP_ASSIGN)
 ///
-/// equality: relational
-/// euqality: euqality "==" relational
-/// euqality: euqality "!=" relational
+/// expr(bp): unary
+/// expr(bp): expr(bp) binop expr(binop.bp + 1)  (binop.bp >= bp, 左結合)
+/// expr(bp): unary binop expr(binop.bp)         (binop.bp >= bp, 右結合)
 ///
-/// relational: add
-/// relational: relational "<" add
-/// relational: relational "<=" add
-/// relational: relational ">" add
-/// relational: relational ">=" add
-///
-/// add: mul
-/// add: add "+" mul
-/// add: add "-" mul
-///
-/// mul: unary
-/// mul: mul "*" unary
-/// mul: mul "/" unary
+/// binop: binops表を参照
+///   "="                  BP_ASSIGN     右結合
+///   "==" "!="            BP_EQUALITY
+///   "<" "<=" ">" ">="    BP_RELATIONAL
+///   "+" "-"              BP_ADD
+///   "*" "/"              BP_MUL
 ///
 /// unary: term
 /// unary: "+" term
 /// unary: "-" term
 ///
 /// term: num
-/// term: "(" assign ")"Node *assign() {
+/// term: ident
+/// term: ident "(" [assign ("," assign)*] ")"
+/// term: "(" expr(BP_EQUALITY) ")"
 
-std::vector<Node *> program() {
-    std::vector<Node *> code;
+// 構文エラーを見つけたときに投げる例外
+// エラー内容はdiagnosticsに記録済みで、文の区切りまで読み飛ばして回復する
+struct ParseError {};
 
-    while (tokens[pos].ty != TK_EOF) code.push_back(stmt());
+[[noreturn]] static void syntax_error(const char *msg) {
+    error_at(tokens[pos].input, "%s", msg);
+    throw ParseError{};
+}
 
-    return code;
+static void expect(int ty, const char *msg) {
+    if (!consume(ty)) syntax_error(msg);
 }
 
+// エラーの後、次の文の先頭まで読み飛ばす
+// ';'は読み飛ばし、ブロック内では対応する'}'の手前で止まる
+static void synchronize(bool in_block) {
+    int depth = 0;
+    while (tokens[pos].ty != TK_EOF) {
+        int ty = tokens[pos].ty;
+        if (ty == '}' && depth == 0 && in_block) return;
+        pos++;
+        if (ty == ';' && depth == 0) return;
+        if (ty == '{') depth++;
+        if (ty == '}' && --depth <= 0) return;
+    }
+}
+
+// 現在パース中の関数（ローカル変数の登録先）
+static NodeFunc *current_func;
+
+static void add_local(const std::string &name) {
+    if (!current_func) return;
+    auto &locals = current_func->locals;
+    if (std::find(locals.begin(), locals.end(), name) == locals.end())
+        locals.push_back(name);
+}
+
+static NodeFunc *find_func(std::vector<NodeFunc *> &funcs,
+                           const std::string &name) {
+    for (auto f : funcs)
+        if (f->name == name) return f;
+    return nullptr;
+}
+
+// 現在位置から関数定義（ident "(" ... ")" "{"）が始まっているか
+static bool is_funcdef() {
+    if (tokens[pos].ty != TK_IDENT || tokens[pos + 1].ty != '(') return false;
+
+    int i = pos + 2;
+    while (tokens[i].ty != ')' && tokens[i].ty != TK_EOF) i++;
+    return tokens[i].ty == ')' && tokens[i + 1].ty == '{';
+}
+
+static NodeFunc *funcdef() {
+    auto &name = tokens[pos];
+    pos += 2;  // ident "("
+
+    std::vector<std::string> params;
+    if (!consume(')')) {
+        do {
+            if (tokens[pos].ty != TK_IDENT) syntax_error("引数名ではありません");
+            params.push_back(tokens[pos++].name);
+        } while (consume(','));
+        expect(')', "')'ではないトークンです");
+    }
+    if (params.size() > MAX_ARGS)
+        error_at(name.input, "引数は%d個までです", MAX_ARGS);
+
+    auto func = new_node_func(name.name, std::move(params));
+    func->loc = name.input;
+    current_func = func;
+
+    expect('{', "'{'ではないトークンです");
+    while (!consume('}')) {
+        if (tokens[pos].ty == TK_EOF) syntax_error("'}'がありません");
+        try {
+            func->body.push_back(stmt());
+        } catch (ParseError &) {
+            synchronize(true);
+        }
+    }
+    return func;
+}
+
+std::vector<NodeFunc *> program() {
+    std::vector<NodeFunc *> funcs;
+    NodeFunc *implicit_main = nullptr;
+
+    while (tokens[pos].ty != TK_EOF) {
+        auto loc = tokens[pos].input;
+        try {
+            if (is_funcdef()) {
+                auto func = funcdef();
+                if (find_func(funcs, func->name))
+                    error_at(loc, "関数%sが重複して定義されています",
+                             func->name.c_str());
+                funcs.push_back(func);
+                continue;
+            }
+
+            // 関数の外に書かれた文は暗黙のmain関数の本体になる
+            if (!implicit_main) {
+                if (find_func(funcs, "main"))
+                    error_at(loc, "main関数の外に文があります");
+                implicit_main = new_node_func("main", {});
+                implicit_main->loc = loc;
+                funcs.push_back(implicit_main);
+            }
+            current_func = implicit_main;
+            implicit_main->body.push_back(stmt());
+        } catch (ParseError &) {
+            synchronize(false);
+        }
+    }
+
+    return funcs;
+}
+
+// 文を読み、その先頭の位置を記録する
 Node *stmt() {
+    auto loc = tokens[pos].input;
+    auto node = parse_stmt();
+    node->loc = loc;
+    return node;
+}
+
+static Node *parse_stmt() {
     Node *node;
 
-    if (consume(TK_RETURN)) {
+    // 文の種類は先頭トークンで決まるので、トークンの型で一度だけ分岐する
+    switch (tokens[pos++].ty) {
+    case TK_RETURN:
         node = new_node_return(assign());
-    } else if (consume(TK_IF)) {
-        if (!consume('(')) error("'('ではないトークンです: %s", tokens[pos].input);
+        break;
+    case TK_IF: {
+        expect('(', "'('ではないトークンです");
         auto cond = assign();
-        if (!consume(')')) error("')'ではないトークンです: %s", tokens[pos].input);
+        expect(')', "')'ではないトークンです");
         auto then = stmt();
         if (consume(TK_ELSE)) {
             auto els = stmt();
@@ -126,29 +253,30 @@ Node *stmt() {
         } else {
             return new_node_if(cond, then, nullptr);
         }
-    } else if (consume(TK_FOR)) {
+    }
+    case TK_FOR: {
         Node *init, *cond, *proc, *block;
-        if (!consume('(')) error("'('ではないトークンです: %s", tokens[pos].input);
+        expect('(', "'('ではないトークンです");
 
         if (consume(';')) {
             init = nullptr;
         } else {
             init = assign();
-            if (!consume(';')) error("';'ではないトークンです: %s", tokens[pos].input);
+            expect(';', "';'ではないトークンです");
         }
 
         if (consume(';')) {
             cond = nullptr;
         } else {
             cond = assign();
-            if (!consume(';')) error("';'ではないトークンです: %s", tokens[pos].input);
+            expect(';', "';'ではないトークンです");
         }
 
         if (consume(')')) {
             proc = nullptr;
         } else {
             proc = assign();
-            if (!consume(')')) error("')'ではないトークンです: %s", tokens[pos].input);
+            expect(')', "')'ではないトークンです");
         }
 
         if (consume(';')) {
@@ -158,14 +286,15 @@ Node *stmt() {
         }
 
         return new_node_for(init, cond, proc, block);
-    } else if (consume(TK_WHILE)) {
+    }
+    case TK_WHILE: {
         Node *cond, *block;
-        if (!consume('(')) error("'('ではないトークンです: %s", tokens[pos].input);
+        expect('(', "'('ではないトークンです");
         if (consume(')')) {
             cond = nullptr;
         } else {
             cond = assign();
-            if (!consume(')')) error("')'ではないトークンです: %s", tokens[pos].input);
+            expect(')', "')'ではないトークンです");
         }
 
         if (consume(';')) {
@@ -175,115 +304,186 @@ Node *stmt() {
         }
 
         return new_node_while(cond, block);
-    } else if (consume('{')) {
+    }
+    case '{': {
         std::vector<Node*> stmts{};
-        for (;;) {
-            stmts.push_back(stmt());
-            if (consume('}')) { break; }
+        while (!consume('}')) {
+            if (tokens[pos].ty == TK_EOF) syntax_error("'}'がありません");
+            try {
+                stmts.push_back(stmt());
+            } catch (ParseError &) {
+                synchronize(true);
+            }
         }
         return new_node_block(std::move(stmts));
-    } else {
+    }
+    default:
+        pos--;
         node = assign();
+        break;
     }
 
-    if (!consume(';')) error("';'ではないトークンです: %s", tokens[pos].input);
+    expect(';', "';'ではないトークンです");
     return node;
 }
 
-Node *assign() {
-    Node *node = equality();
-    if (consume('=')) node = new_node('=', node, assign());
-    return node;
-}
-
-Node *equality() {
-    Node *node = relational();
+// 二項演算子の情報
+struct BinOp {
+    int bp;            //! 結合力（0なら二項演算子ではない）
+    int node_ty;       //! 生成するノードの型
+    bool right_assoc;  //! 右結合ならtrue
+};
+
+// 演算子の優先順位（大きいほど強く結合する）
+enum {
+    BP_ASSIGN = 1,
+    BP_EQUALITY,
+    BP_RELATIONAL,
+    BP_ADD,
+    BP_MUL,
+};
+
+// トークンの型から二項演算子の情報を引く表
+static constexpr auto binops = [] {
+    std::array<BinOp, TK_NUM_KINDS> t{};
+    t['='] = {BP_ASSIGN, '=', true};
+    t[TK_EQ] = {BP_EQUALITY, ND_EQ, false};
+    t[TK_NE] = {BP_EQUALITY, ND_NE, false};
+    t['<'] = {BP_RELATIONAL, '<', false};
+    t[TK_LE] = {BP_RELATIONAL, ND_LE, false};
+    t['>'] = {BP_RELATIONAL, '>', false};
+    t[TK_GE] = {BP_RELATIONAL, ND_GE, false};
+    t['+'] = {BP_ADD, '+', false};
+    t['-'] = {BP_ADD, '-', false};
+    t['*'] = {BP_MUL, '*', false};
+    t['/'] = {BP_MUL, '/', false};
+    return t;
+}();
+
+// 式の途中で、続きの部分式を読み終えるのを待っている構文
+struct ExprFrame {
+    enum Kind {
+        BINOP,  //! 二項演算子の右辺
+        PAREN,  //! カッコの中身
+        NEG,    //! 単項マイナスの被演算子
+        CALL,   //! 関数呼び出しの引数
+    } kind;
+    int min_bp;              //! この構文を含む式の結合力の下限
+    Node *lhs = nullptr;     //! BINOP: 左辺
+    int node_ty = 0;         //! BINOP: 生成するノードの型
+    size_t ident = 0;        //! CALL: 関数名のトークンの位置
+    std::vector<Node *> args;  //! CALL: 読み終えた引数
+};
+
+// 結合力がmin_bp以上の二項演算子だけを取り込んで式を読む（Prattパーサ）
+// 優先順位ごとの関数を経由せず、トークン1つにつき表を1回引くだけで済む
+//
+// 深くネストしたカッコや長い代入の連鎖でもネイティブのスタックを使い切らないよう、
+// 再帰せずに読みかけの構文をframesに積んでいく。
+static Node *expr(int min_bp) {
+    std::vector<ExprFrame> frames;
+    int bp = min_bp;
 
     for (;;) {
-        if (consume(TK_EQ))
-            node = new_node(ND_EQ, node, relational());
-        else if (consume(TK_NE))
-            node = new_node(ND_NE, node, relational());
-        else
-            return node;
-    }
-}
-
-Node *relational() {
-    Node *node = add();
-
-    for (;;) {
-        if (consume('<'))
-            node = new_node('<', node, add());
-        else if (consume(TK_LE))
-            node = new_node(ND_LE, node, add());
-        else if (consume('>'))
-            node = new_node('>', node, add());
-        else if (consume(TK_GE))
-            node = new_node(ND_GE, node, add());
-        else
-            return node;
-    }
-}
-
-Node *add() {
-    Node *node = mul();
+        // 項を1つ読む（カッコと関数呼び出しは中身の式を読むためにframesに積む）
+        Node *node = nullptr;
+        if (consume('+')) {
+            // 単項演算子の直後は項だけを許す
+        } else if (consume('-')) {
+            frames.push_back({ExprFrame::NEG, bp});
+        }
 
-    for (;;) {
-        if (consume('+'))
-            node = new_node('+', node, mul());
-        else if (consume('-'))
-            node = new_node('-', node, mul());
-        else
-            return node;
-    }
-}
+        if (consume('(')) {
+            frames.push_back({ExprFrame::PAREN, bp});
+            bp = BP_EQUALITY;
+            continue;
+        }
 
-Node *mul() {
-    Node *node = unary();
+        if (tokens[pos].ty == TK_IDENT) {
+            size_t ident = pos++;
+
+            // 識別子の直後が'('なら関数呼び出し
+            if (consume('(')) {
+                ExprFrame call{ExprFrame::CALL, bp};
+                call.ident = ident;
+                if (!consume(')')) {
+                    frames.push_back(std::move(call));
+                    bp = BP_ASSIGN;
+                    continue;
+                }
+                node = new_node_call(tokens[ident].name, {});
+            } else {
+                add_local(tokens[ident].name);
+                node = new_node_ident(tokens[ident].name);
+            }
+        } else if (tokens[pos].ty == TK_NUM) {
+            node = new_node_num(tokens[pos++].val);
+        } else {
+            syntax_error("想定外のトークンです");
+        }
 
-    for (;;) {
-        if (consume('*'))
-            node = new_node('*', node, unary());
-        else if (consume('/'))
-            node = new_node('/', node, unary());
-        else
-            return node;
+        // 読み終えた項や式を、それを待っている構文に渡していく
+        // 単項マイナスは項の直後にしか積まれていないので、先に適用する
+        for (;;) {
+            if (!frames.empty() && frames.back().kind == ExprFrame::NEG) {
+                node = new_node('-', new_node_num(0), node);
+                frames.pop_back();
+            }
+
+            auto &op = binops[tokens[pos].ty];
+            if (op.bp >= bp && op.bp != 0) {
+                pos++;
+                frames.push_back({ExprFrame::BINOP, bp, node, op.node_ty});
+                bp = op.right_assoc ? op.bp : op.bp + 1;
+                break;
+            }
+
+            if (frames.empty()) return node;
+            auto &f = frames.back();
+            bp = f.min_bp;
+
+            if (f.kind == ExprFrame::BINOP) {
+                node = new_node(f.node_ty, f.lhs, node);
+                frames.pop_back();
+                continue;
+            }
+
+            if (f.kind == ExprFrame::PAREN) {
+                expect(')', "開きカッコに対応する閉じカッコがありません");
+                frames.pop_back();
+                continue;
+            }
+
+            // CALL
+            f.args.push_back(node);
+            if (consume(',')) {
+                bp = BP_ASSIGN;
+                break;
+            }
+            expect(')', "')'ではないトークンです");
+            if (f.args.size() > MAX_ARGS)
+                error_at(tokens[f.ident].input, "引数は%d個までです", MAX_ARGS);
+            node = new_node_call(tokens[f.ident].name, std::move(f.args));
+            frames.pop_back();
+        }
     }
 }
 
-Node *unary() {
-    if (consume('+')) return term();
-    if (consume('-')) return new_node('-', new_node_num(0), term());
-    return term();
-}
-
-Node *term() {
-    // 次のトークンが'('なら、"(" add ")"のはず
-    if (consume('(')) {
-        Node *node = equality();
-        if (!consume(')'))
-            error("開きカッコに対応する閉じカッコがありません: %s",
-                  tokens[pos].input);
-        return node;
-    }
-
-    if (tokens[pos].ty == TK_IDENT) return new_node_ident(tokens[pos++].name);
-
-    if (tokens[pos].ty == TK_NUM) return new_node_num(tokens[pos++].val);
-
-    error("想定外のトークンです: %s", tokens[pos].input);
-
-    return nullptr;  // unreachable
-}
+Node *assign() { return expr(BP_ASSIGN); }
+Node *equality() { return expr(BP_EQUALITY); }
+Node *relational() { return expr(BP_RELATIONAL); }
+Node *add() { return expr(BP_ADD); }
+Node *mul() { return expr(BP_MUL); }
 
-std::vector<Node *> parse() {
+std::vector<NodeFunc *> parse() {
     pos = 0;
+    current_func = nullptr;
     return program();
 }
 
 #ifdef UNIT_TEST
 void parser_init() {
     pos = 0;
+    current_func = nullptr;
 }
 #endif
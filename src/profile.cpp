@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "9cc.hpp"
+#include "codegen.hpp"
+
+// 最大の実行回数に対してこの割合以上回っていれば頻繁に実行される
+constexpr int HOT_RATIO = 10;
+// もう一方の分岐に比べてこの割合以下しか通らなければ滅多に実行されない
+constexpr int COLD_RATIO = 8;
+
+Profile profile;
+
+bool Profile::hot(int probe) const {
+    long n = count(probe);
+    return n > 0 && n * HOT_RATIO >= max_count;
+}
+
+bool Profile::cold(int probe, int other) const {
+    return count(other) > 0 && count(probe) * COLD_RATIO <= count(other);
+}
+
+// 構文木を行きがけ順にたどって番号を振る
+// 深い木でもスタックを使い切らないよう、再帰せずにたどる
+static void assign_probe(Node *root, int &next) {
+    std::vector<Node *> stack{root};
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+
+        if (auto n = dynamic_cast<NodeIf *>(node)) {
+            n->probe = next;
+            next += 2;
+        } else if (auto n = dynamic_cast<NodeFor *>(node)) {
+            n->probe = next++;
+        } else if (auto n = dynamic_cast<NodeWhile *>(node)) {
+            n->probe = next++;
+        }
+
+        // 先頭の子から順に取り出すよう、逆順に積む
+        size_t base = stack.size();
+        node->each_child([&](Node *&child) { stack.push_back(child); });
+        std::reverse(stack.begin() + base, stack.end());
+    }
+}
+
+// 分岐とループに計測番号を振る
+// 番号は構文木の並びだけで決まるので、同じプログラムなら計測時と利用時で一致する
+void assign_probes(std::vector<NodeFunc *> &code) {
+    int next = 0;
+    for (auto f : code)
+        for (auto n : f->body) assign_probe(n, next);
+    profile.num_probes = next;
+}
+
+// --instrumentで作ったプログラムが書き出した実行回数を読み込む
+bool load_profile(const char *path) {
+    auto fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "プロファイルを開けません: %s\n", path);
+        return false;
+    }
+
+    int num;
+    unsigned long hash;
+    if (fscanf(fp, "9cc-profile %d %lu", &num, &hash) != 2 ||
+        num != profile.num_probes || hash != profile.hash) {
+        fprintf(stderr, "プロファイルがプログラムと一致しません: %s\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<long> counts(num);
+    int id;
+    long n;
+    while (fscanf(fp, "%d %ld", &id, &n) == 2) {
+        if (0 <= id && id < num) counts[id] = n;
+    }
+    fclose(fp);
+
+    profile.counts = std::move(counts);
+    profile.max_count = 0;
+    for (auto c : profile.counts)
+        if (c > profile.max_count) profile.max_count = c;
+    return true;
+}
+
+// 計測用のカウンタと、終了時にそれを書き出す関数を出力する
+void gen_profile_runtime() {
+    emit(".bss\n");
+    emit(".p2align 3\n");
+    emit("__9cc_counters:\n");
+    emit("  .zero %d\n", profile.num_probes * 8);
+
+    emit(".section .rodata\n");
+    emit("__9cc_profile_path:\n");
+    emit("  .string \"%s\"\n", asm_string(profile.path).c_str());
+    emit("__9cc_profile_mode:\n");
+    emit("  .string \"w\"\n");
+    emit("__9cc_profile_header:\n");
+    emit("  .string \"9cc-profile %d %lu\\n\"\n", profile.num_probes, profile.hash);
+    emit("__9cc_profile_line:\n");
+    emit("  .string \"%%d %%ld\\n\"\n");
+
+    // プログラムの終了時に呼ばれるようにする
+    emit(".section .fini_array, \"aw\"\n");
+    emit("  .quad __9cc_dump_profile\n");
+
+    emit(".text\n");
+    emit("__9cc_dump_profile:\n");
+    emit("  push rbp\n");
+    emit("  mov rbp, rsp\n");
+    emit("  push rbx\n");
+    emit("  push r12\n");
+    emit("  lea rdi, [rip + __9cc_profile_path]\n");
+    emit("  lea rsi, [rip + __9cc_profile_mode]\n");
+    emit("  call fopen\n");
+    emit("  test rax, rax\n");
+    emit("  jz .L9cc_dump_end\n");
+    emit("  mov rbx, rax\n");
+    emit("  mov rdi, rbx\n");
+    emit("  lea rsi, [rip + __9cc_profile_header]\n");
+    emit("  mov rax, 0\n");
+    emit("  call fprintf\n");
+    emit("  mov r12, 0\n");
+    emit(".L9cc_dump_loop:\n");
+    emit("  cmp r12, %d\n", profile.num_probes);
+    emit("  jge .L9cc_dump_close\n");
+    emit("  mov rdi, rbx\n");
+    emit("  lea rsi, [rip + __9cc_profile_line]\n");
+    emit("  mov rdx, r12\n");
+    emit("  lea rax, [rip + __9cc_counters]\n");
+    emit("  mov rcx, [rax + r12 * 8]\n");
+    emit("  mov rax, 0\n");
+    emit("  call fprintf\n");
+    emit("  inc r12\n");
+    emit("  jmp .L9cc_dump_loop\n");
+    emit(".L9cc_dump_close:\n");
+    emit("  mov rdi, rbx\n");
+    emit("  call fclose\n");
+    emit(".L9cc_dump_end:\n");
+    emit("  pop r12\n");
+    emit("  pop rbx\n");
+    emit("  pop rbp\n");
+    emit("  ret\n");
+}
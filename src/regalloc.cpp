@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "9cc.hpp"
+
+// ローカル変数を置くレジスタ
+// 関数呼び出しをまたいでも値が保たれるcallee-savedレジスタを使う
+static const char *callee_saved[] = {"rbx", "r12", "r13", "r14", "r15"};
+// 関数呼び出しを含まない関数では、式の計算にも引数にも使わないこれらも使える
+static const char *leaf_regs[] = {"r10", "r11"};
+
+// プロファイルがないとき、ループ1段あたりの使用回数の重み
+constexpr long LOOP_WEIGHT = 8;
+
+// 変数ごとの使用回数（ループの中ほど重く数える）
+struct UseCounter {
+    std::unordered_map<std::string, long> weight;
+    std::unordered_set<std::string> pinned;  //! メモリに置く必要がある変数
+    bool has_call = false;
+
+    void visit(Node *node, long w);
+};
+
+void UseCounter::visit(Node *node, long w) {
+    if (auto n = dynamic_cast<NodeIdent *>(node)) {
+        weight[n->name] += w;
+        return;
+    }
+
+    if (dynamic_cast<NodeCall *>(node)) has_call = true;
+
+    // インライン展開の途中のreturnはrspをメモリ上の変数から戻す
+    if (auto n = dynamic_cast<NodeInline *>(node)) {
+        if (!n->sp_slot.empty()) pinned.insert(n->sp_slot);
+        for (auto &p : n->params) weight[p] += w;
+    }
+
+    int probe = -1;
+    if (auto n = dynamic_cast<NodeFor *>(node)) probe = n->probe;
+    if (auto n = dynamic_cast<NodeWhile *>(node)) probe = n->probe;
+    if (probe >= 0) {
+        // プロファイルがあれば実際に回った回数で重み付けする
+        long inner = profile.loaded() ? std::max(1L, profile.count(probe)) : w * LOOP_WEIGHT;
+        node->each_child([&](Node *&child) { visit(child, inner); });
+        return;
+    }
+
+    node->each_child([&](Node *&child) { visit(child, w); });
+}
+
+// ローカル変数をスタック上の領域からレジスタに移す
+//
+// この言語では変数のアドレスを取る手段がないので、どの変数もレジスタに置ける。
+// 使用回数の重みが大きい順に、関数の先頭から末尾までレジスタを1つ割り当てる。
+void promote_locals(std::vector<NodeFunc *> &code) {
+    for (auto f : code) {
+        f->reg_locals.clear();
+        if (too_deep(f)) continue;
+
+        UseCounter counter;
+        for (auto &p : f->params) counter.weight[p] += 1;
+        for (auto n : f->body) counter.visit(n, 1);
+
+        // 保存・復元が要らない分、使えるなら呼び出し側で保存するレジスタから使う
+        std::vector<const char *> regs;
+        if (!counter.has_call) regs.assign(std::begin(leaf_regs), std::end(leaf_regs));
+        regs.insert(regs.end(), std::begin(callee_saved), std::end(callee_saved));
+
+        std::vector<std::string> candidates;
+        for (auto &v : f->locals)
+            if (counter.weight[v] > 0 && !counter.pinned.count(v)) candidates.push_back(v);
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [&](auto &a, auto &b) { return counter.weight[a] > counter.weight[b]; });
+
+        for (size_t i = 0; i < candidates.size() && i < regs.size(); i++)
+            f->reg_locals.push_back({candidates[i], regs[i]});
+    }
+}
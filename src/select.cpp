@@ -0,0 +1,146 @@
+#include <cstdio>
+
+#include "9cc.hpp"
+#include "codegen.hpp"
+
+// 分岐をやめて両方の値を計算してもよい、両辺の計算コストの合計の上限
+// （分岐予測を外したときの損失に見合う程度の命令数）
+constexpr int SELECT_MAX_COST = 10;
+
+// 1文だけのブロックはその文として扱う
+static Node *unwrap(Node *node) {
+    auto block = dynamic_cast<NodeBlock *>(node);
+    while (block && block->block.size() == 1) {
+        node = block->block[0];
+        block = dynamic_cast<NodeBlock *>(node);
+    }
+    return node;
+}
+
+// 副作用がなく、条件と無関係に計算してもよい式か
+// 除算は0除算で落ちることがあるので含めない
+static bool is_speculatable(Node *node) {
+    if (dynamic_cast<NodeNum *>(node) || dynamic_cast<NodeIdent *>(node)) return true;
+
+    auto n = dynamic_cast<NodeGeneral *>(node);
+    if (!n) return false;
+    switch (n->ty) {
+    case '+':
+    case '-':
+    case '*':
+    case ND_EQ:
+    case ND_NE:
+    case '<':
+    case ND_LE:
+    case '>':
+    case ND_GE:
+        return is_speculatable(n->lhs) && is_speculatable(n->rhs);
+    }
+    return false;
+}
+
+// 両辺が同じ変数への代入か、どちらもreturnであるif文の、それぞれの値
+struct SelectArms {
+    Node *then_value = nullptr;
+    Node *else_value = nullptr;
+    NodeIdent *var = nullptr;  //! 代入先（returnならnullptr）
+};
+
+static bool match_select(NodeIf *node, SelectArms &arms) {
+    if (!node->els) return false;
+    auto then = dynamic_cast<NodeGeneral *>(unwrap(node->then));
+    auto els = dynamic_cast<NodeGeneral *>(unwrap(node->els));
+    if (!then || !els || then->ty != els->ty) return false;
+
+    if (then->ty == ND_RETURN) {
+        arms.then_value = then->lhs;
+        arms.else_value = els->lhs;
+    } else if (then->ty == '=') {
+        auto x = dynamic_cast<NodeIdent *>(then->lhs);
+        auto y = dynamic_cast<NodeIdent *>(els->lhs);
+        if (!x || !y || x->name != y->name) return false;
+        arms.var = x;
+        arms.then_value = then->rhs;
+        arms.else_value = els->rhs;
+    } else {
+        return false;
+    }
+    return is_speculatable(arms.then_value) && is_speculatable(arms.else_value);
+}
+
+// 分岐なしにするかどうかを決める
+//
+// 両辺を必ず計算する分だけ命令は増えるので、両辺が安い場合に限る。
+// プロファイルがあり、片方にほとんど偏っている分岐は予測が当たるので分岐のまま残す。
+static void select_node(Node *node, GenContext &context) {
+    node->each_child([&](Node *&child) { select_node(child, context); });
+
+    auto n = dynamic_cast<NodeIf *>(node);
+    SelectArms arms;
+    if (!n || !match_select(n, arms)) return;
+
+    int cost = expr_cost(arms.then_value, context) + expr_cost(arms.else_value, context);
+    if (cost > SELECT_MAX_COST) return;
+    if (profile.cold(n->probe, n->probe + 1) || profile.cold(n->probe + 1, n->probe)) return;
+    n->branchless = true;
+}
+
+// 単純な値の選択になっているif文に、cmovで分岐なしにする印を付ける
+// 計測中は両辺の実行回数を数えるために分岐のまま残す
+void select_branchless(std::vector<NodeFunc *> &code) {
+    if (profile.instrument) return;
+
+    for (auto f : code) {
+        if (too_deep(f)) continue;
+
+        // 命令のコストは変数がレジスタにあるかどうかで変わる
+        GenContext context;
+        for (auto &[var, reg] : f->reg_locals) context.regs[var] = reg;
+        for (auto n : f->body) select_node(n, context);
+    }
+}
+
+// 印の付いたif文を、両辺の値を計算してからcmovで選ぶコードにする
+bool gen_select(NodeIf *node, GenContext &context) {
+    SelectArms arms;
+    if (!node->branchless || !match_select(node, arms)) return false;
+
+    auto then_leaf = !dynamic_cast<NodeGeneral *>(arms.then_value);
+    auto else_leaf = !dynamic_cast<NodeGeneral *>(arms.else_value);
+    if (then_leaf && else_leaf) {
+        // 両辺が葉なら、比較の後にmovとcmovで直接選ぶ（movはフラグを変えない）
+        auto cc = gen_cond(node->cond, context);
+        emit("  mov rax, %s\n", leaf_operand(arms.else_value, context).c_str());
+        auto src = leaf_operand(arms.then_value, context);
+        if (dynamic_cast<NodeNum *>(arms.then_value)) {
+            emit("  mov rdi, %s\n", src.c_str());
+            src = "rdi";
+        }
+        emit("  cmov%s rax, %s\n", cc.c_str(), src.c_str());
+    } else {
+        // 両辺の計算でフラグが壊れるので、条件は先に0か1にしてスタックに退避しておく
+        // （共通部分式の一時変数への代入が条件の中にあることがあるので、条件を先に計算する）
+        gen_expr(node->cond, context);
+        emit("  push rax\n");
+        gen_expr(arms.else_value, context);
+        emit("  push rax\n");
+        gen_expr(arms.then_value, context);
+        emit("  mov rdi, rax\n");
+        emit("  pop rax\n");
+        emit("  pop rcx\n");
+        emit("  cmp rcx, 0\n");
+        emit("  cmovne rax, rdi\n");
+    }
+
+    if (!arms.var) {
+        gen_return_jump(context);
+        return true;
+    }
+    if (auto reg = context.reg_of(arms.var->name)) {
+        emit("  mov %s, rax\n", reg);
+    } else {
+        emit("  mov [rbp-%d], rax\n", context.var_put(arms.var->name));
+    }
+    emit("  push rax\n");
+    return true;
+}
@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "9cc.hpp"
+
+// パース済みの構文木のバイナリ形式
+//
+// ファイルは先頭のヘッダと、それに続くレコードの列からなる。値はすべて4バイト境界に
+// 置いた32ビット整数（リトルエンディアン）。他のレコードはポインタではなく、
+// 参照を書いた位置からの相対オフセットで指す（0はnullptr）。子は必ず親より前に
+// 置くので、ファイルを先頭から1回なめるだけで木を組み立てられる。
+//
+//   ヘッダ:     "9CCAST\0\0" 版数 関数の数 ソース 入力名 関数表
+//   文字列:     AST_STR 長さ 文字列（NUL終端、4バイト境界まで詰める）
+//   ノード:     種類 通し番号 [ソース上の位置] 種類ごとの値
+//               （位置は文のノードにだけあり、そのときは種類にAST_HAS_LOCを足す）
+//   関数表:     AST_FUNCS 関数の数 関数ノード...
+//
+// ソースもファイルに含め、文の位置はその中のオフセットとして持つ。
+// 読み込み時はmmapしたソースをそのままuser_inputにするので、
+// -gの行番号やプロファイルの照合は元のソースから翻訳したときと変わらない。
+
+// 形式を変えたら増やす
+constexpr uint32_t AST_VERSION = 1;
+constexpr char AST_MAGIC[8] = {'9', 'C', 'C', 'A', 'S', 'T', 0, 0};
+constexpr uint32_t HEADER_SIZE = 32;
+
+// レコードの種類
+enum AstKind : uint32_t {
+    AST_STR = 1,
+    AST_GENERAL,  //! ty lhs rhs
+    AST_NUM,      //! val
+    AST_IDENT,    //! name
+    AST_IF,       //! cond then els
+    AST_FOR,      //! init cond proc block
+    AST_WHILE,    //! cond block
+    AST_BLOCK,    //! 文の数 文...
+    AST_CALL,     //! name 引数の数 引数...
+    AST_FUNC,     //! name 引数の数 引数名... 変数の数 変数名... 文の数 文...
+    AST_FUNCS,
+};
+
+// ノードがソース上の位置を持つ印
+constexpr uint32_t AST_HAS_LOC = 0x100;
+
+// ヘッダ中の各値の位置
+enum : uint32_t {
+    HDR_VERSION = 8,
+    HDR_NUM_FUNCS = 12,
+    HDR_SOURCE = 16,
+    HDR_NAME = 20,
+    HDR_FUNCS = 24,
+};
+
+// NodeGeneralの演算子として書かれていてよい値
+static bool is_operator(int ty) {
+    switch (ty) {
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+    case '<':
+    case '>':
+    case '=':
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_GE:
+    case ND_RETURN:
+        return true;
+    }
+    return false;
+}
+
+namespace {
+
+struct AstWriter {
+    std::string buf;
+    std::unordered_map<std::string, uint32_t> strings;  //! 書いた文字列とその位置
+    std::unordered_map<Node *, uint32_t> nodes;         //! 書いたノードとその位置
+    uint32_t num_nodes = 0;
+
+    uint32_t pos() const { return buf.size(); }
+
+    void put(uint32_t v) { buf.append(reinterpret_cast<const char *>(&v), 4); }
+    void put_at(uint32_t at, uint32_t v) { memcpy(&buf[at], &v, 4); }
+
+    // 書き込む位置から見たtargetの相対オフセットを書く
+    void put_ref(uint32_t target) { put(target ? target - pos() : 0); }
+    void put_ref_at(uint32_t at, uint32_t target) { put_at(at, target - at); }
+
+    uint32_t str(const std::string &s) {
+        auto iter = strings.find(s);
+        if (iter != strings.end()) return iter->second;
+
+        uint32_t at = pos();
+        put(AST_STR);
+        put(s.size());
+        buf.append(s);
+        buf.append(4 - s.size() % 4, '\0');
+        strings[s] = at;
+        return at;
+    }
+
+    uint32_t ref(Node *node) { return node ? nodes.at(node) : 0; }
+
+    // ノードのレコードを書く（子と文字列は先に書いてあること）
+    void node(Node *node) {
+        // レコードの途中に文字列を挟まないよう、使う文字列を先に書く
+        if (auto n = dynamic_cast<NodeIdent *>(node)) str(n->name);
+        if (auto n = dynamic_cast<NodeCall *>(node)) str(n->name);
+        if (auto n = dynamic_cast<NodeFunc *>(node)) {
+            str(n->name);
+            for (auto &p : n->params) str(p);
+            for (auto &l : n->locals) str(l);
+        }
+
+        uint32_t at = pos();
+        nodes[node] = at;
+
+        auto header = [&](AstKind kind) {
+            put(kind | (node->loc ? AST_HAS_LOC : 0));
+            put(num_nodes++);
+            if (node->loc) put(node->loc - user_input);
+        };
+        auto refs = [&](const std::vector<Node *> &v) {
+            put(v.size());
+            for (auto n : v) put_ref(ref(n));
+        };
+
+        if (auto n = dynamic_cast<NodeGeneral *>(node)) {
+            header(AST_GENERAL);
+            put(n->ty);
+            put_ref(ref(n->lhs));
+            put_ref(ref(n->rhs));
+        } else if (auto n = dynamic_cast<NodeNum *>(node)) {
+            header(AST_NUM);
+            put(n->val);
+        } else if (auto n = dynamic_cast<NodeIdent *>(node)) {
+            header(AST_IDENT);
+            put_ref(str(n->name));
+        } else if (auto n = dynamic_cast<NodeIf *>(node)) {
+            header(AST_IF);
+            put_ref(ref(n->cond));
+            put_ref(ref(n->then));
+            put_ref(ref(n->els));
+        } else if (auto n = dynamic_cast<NodeFor *>(node)) {
+            header(AST_FOR);
+            put_ref(ref(n->init));
+            put_ref(ref(n->cond));
+            put_ref(ref(n->proc));
+            put_ref(ref(n->block));
+        } else if (auto n = dynamic_cast<NodeWhile *>(node)) {
+            header(AST_WHILE);
+            put_ref(ref(n->cond));
+            put_ref(ref(n->block));
+        } else if (auto n = dynamic_cast<NodeBlock *>(node)) {
+            header(AST_BLOCK);
+            refs(n->block);
+        } else if (auto n = dynamic_cast<NodeCall *>(node)) {
+            header(AST_CALL);
+            put_ref(str(n->name));
+            refs(n->args);
+        } else if (auto n = dynamic_cast<NodeFunc *>(node)) {
+            header(AST_FUNC);
+            put_ref(str(n->name));
+            put(n->params.size());
+            for (auto &p : n->params) put_ref(str(p));
+            put(n->locals.size());
+            for (auto &l : n->locals) put_ref(str(l));
+            refs(n->body);
+        } else {
+            // インライン展開などの後の木は書けない
+            error("構文木を書き出せないノードがあります");
+        }
+    }
+
+    // 子を先に書くよう、nodeを根とする部分木を後行順に書く
+    // 深い木でもスタックを使い切らないよう、再帰せずにたどる
+    void tree(Node *root) {
+        std::vector<std::pair<Node *, bool>> stack{{root, false}};
+        while (!stack.empty()) {
+            auto [node, expanded] = stack.back();
+            stack.pop_back();
+            if (expanded) {
+                this->node(node);
+                continue;
+            }
+            stack.push_back({node, true});
+            size_t first = stack.size();
+            node->each_child([&](Node *&child) { stack.push_back({child, false}); });
+            std::reverse(stack.begin() + first, stack.end());
+        }
+    }
+};
+
+// mmapしたファイルを読むための、範囲を確かめながら値を取り出す道具
+struct AstReader {
+    const char *path;
+    const char *base;
+    uint32_t size;
+
+    void broken() const { error("ASTファイルが壊れています: %s", path); }
+
+    uint32_t get(uint32_t at) const {
+        if (at % 4 != 0 || at > size - 4) broken();
+        uint32_t v;
+        memcpy(&v, base + at, 4);
+        return v;
+    }
+
+    // atに書かれた相対オフセットが指す位置（0ならnullptr相当の0）
+    // 子は親より前にあるので、指す先はlimitより前でなければならない
+    uint32_t deref(uint32_t at, uint32_t limit) const {
+        uint32_t rel = get(at);
+        if (rel == 0) return 0;
+        uint32_t target = at + rel;
+        if (target < HEADER_SIZE || target >= limit) broken();
+        return target;
+    }
+
+    // 文字列レコードの中身（NUL終端されている）
+    const char *str(uint32_t at, uint32_t *len = nullptr) const {
+        if (at == 0 || get(at) != AST_STR) broken();
+        uint32_t n = get(at + 4);
+        if (n >= size - at - 8 || base[at + 8 + n] != '\0') broken();
+        if (len) *len = n;
+        return base + at + 8;
+    }
+
+    uint32_t str_size(uint32_t at) const {
+        uint32_t n;
+        str(at, &n);
+        return 8 + n + (4 - n % 4);
+    }
+};
+
+}  // namespace
+
+// パースしたままの構文木をpathに書き出す
+void save_ast(const char *path, std::vector<NodeFunc *> &code) {
+    AstWriter w;
+    w.buf.append(AST_MAGIC, sizeof(AST_MAGIC));
+    w.put(AST_VERSION);
+    w.put(code.size());
+    w.buf.resize(HEADER_SIZE);
+
+    w.put_ref_at(HDR_SOURCE, w.str(user_input));
+    w.put_ref_at(HDR_NAME, w.str(input_name));
+    for (auto f : code) w.tree(f);
+
+    w.put_ref_at(HDR_FUNCS, w.pos());
+    w.put(AST_FUNCS);
+    w.put(code.size());
+    for (auto f : code) w.put_ref(w.ref(f));
+
+    auto fp = fopen(path, "wb");
+    if (!fp) error("ファイルを開けません: %s", path);
+    fwrite(w.buf.data(), 1, w.buf.size(), fp);
+    if (fclose(fp) != 0) error("ファイルに書き込めません: %s", path);
+}
+
+// save_astで書き出した構文木を読み込む
+//
+// ファイルはmmapしたまま使い、ソースはその中を直接user_inputとして指す。
+// コード生成は仮想関数を持つノードを前提にしているので、ノードのオブジェクトだけは
+// レコードを先頭から1回なめて作る（子は親より前にあるので、作った順に引ける）。
+std::vector<NodeFunc *> load_ast(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) error("ファイルを開けません: %s", path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE || st.st_size > UINT32_MAX / 2)
+        error("ASTファイルではありません: %s", path);
+    auto base = static_cast<const char *>(
+        mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (base == MAP_FAILED) error("ファイルを読み込めません: %s", path);
+
+    AstReader r{path, base, static_cast<uint32_t>(st.st_size)};
+    if (memcmp(base, AST_MAGIC, sizeof(AST_MAGIC)) != 0)
+        error("ASTファイルではありません: %s", path);
+    if (r.get(HDR_VERSION) != AST_VERSION)
+        error("ASTファイルの版が違います（%u、対応しているのは%u）: %s", r.get(HDR_VERSION),
+              AST_VERSION, path);
+
+    uint32_t source_len;
+    user_input = r.str(r.deref(HDR_SOURCE, r.size), &source_len);
+    input_name = r.str(r.deref(HDR_NAME, r.size));
+
+    // 作ったノードを通し番号で引く表と、そのレコードの位置
+    // 壊れたファイルから木でない（同じノードを2回参照する）構造を作らないよう、
+    // 子として使ったノードには印を付ける
+    std::vector<Node *> nodes;
+    std::vector<uint32_t> node_pos;
+    std::vector<bool> used;
+
+    uint32_t at = HEADER_SIZE;
+    uint32_t next = 0;  // 読んでいるレコードの次の値の位置
+    auto word = [&] { return r.get((next += 4) - 4); };
+    auto string = [&] { return std::string(r.str(r.deref((next += 4) - 4, r.size))); };
+    // 関数のノードは関数表からだけ指せる（パーサは関数を入れ子にしない）
+    auto child = [&](bool func = false) -> Node * {
+        uint32_t target = r.deref((next += 4) - 4, at);
+        if (target == 0) return nullptr;
+        uint32_t id = r.get(target + 4);
+        if (id >= nodes.size() || node_pos[id] != target || used[id]) r.broken();
+        if (!dynamic_cast<NodeFunc *>(nodes[id]) != !func) r.broken();
+        used[id] = true;
+        return nodes[id];
+    };
+    auto required = [&] {
+        auto n = child();
+        if (!n) r.broken();
+        return n;
+    };
+    // 要素数はファイルの残りの大きさで抑えてから確保する
+    auto count = [&] {
+        uint32_t n = word();
+        if (n > (r.size - next) / 4) r.broken();
+        return n;
+    };
+    auto children = [&] {
+        std::vector<Node *> v(count());
+        for (auto &n : v) n = required();
+        return v;
+    };
+
+    while (at < r.size) {
+        uint32_t kind = r.get(at);
+        if (kind == AST_STR) {
+            at += r.str_size(at);
+            continue;
+        }
+        if (kind == AST_FUNCS) break;
+
+        if (r.get(at + 4) != nodes.size()) r.broken();
+        next = at + 8;
+        const char *loc = nullptr;
+        if (kind & AST_HAS_LOC) {
+            uint32_t offset = word();
+            if (offset >= source_len) r.broken();
+            loc = user_input + offset;
+            kind &= ~AST_HAS_LOC;
+        }
+
+        Node *node = nullptr;
+        switch (kind) {
+        case AST_GENERAL: {
+            int ty = word();
+            if (!is_operator(ty)) r.broken();
+            // returnだけは右辺がない
+            auto lhs = required();
+            auto rhs = child();
+            if (!rhs != (ty == ND_RETURN)) r.broken();
+            node = new NodeGeneral(ty, lhs, rhs);
+            break;
+        }
+        case AST_NUM:
+            node = new NodeNum(word());
+            break;
+        case AST_IDENT:
+            node = new NodeIdent(string());
+            break;
+        case AST_IF: {
+            auto cond = required();
+            auto then = required();
+            node = new NodeIf(cond, then, child());
+            break;
+        }
+        case AST_FOR: {
+            auto init = child();
+            auto cond = child();
+            auto proc = child();
+            node = new NodeFor(init, cond, proc, child());
+            break;
+        }
+        case AST_WHILE: {
+            auto cond = child();
+            node = new NodeWhile(cond, child());
+            break;
+        }
+        case AST_BLOCK:
+            node = new NodeBlock(children());
+            break;
+        case AST_CALL: {
+            // 引数の数はパーサと同じくMAX_ARGSまで（コード生成はレジスタで渡す）
+            auto name = string();
+            auto args = children();
+            if (args.size() > MAX_ARGS) r.broken();
+            node = new NodeCall(name, std::move(args));
+            break;
+        }
+        case AST_FUNC: {
+            auto name = string();
+            uint32_t num_params = count();
+            if (num_params > MAX_ARGS) r.broken();
+            std::vector<std::string> params(num_params);
+            for (auto &p : params) p = string();
+            auto func = new NodeFunc(name, std::move(params));
+            func->locals.resize(count());
+            for (auto &l : func->locals) l = string();
+            // 引数はローカル変数の先頭に同じ並びで入っている
+            if (func->locals.size() < num_params ||
+                !std::equal(func->params.begin(), func->params.end(), func->locals.begin()))
+                r.broken();
+            func->body = children();
+            node = func;
+            break;
+        }
+        default:
+            r.broken();
+        }
+        node->loc = loc;
+        nodes.push_back(node);
+        node_pos.push_back(at);
+        used.push_back(false);
+        at = next;
+    }
+
+    // 関数表
+    if (at != r.deref(HDR_FUNCS, r.size)) r.broken();
+    next = at + 4;
+    uint32_t num_funcs = count();
+    if (num_funcs != r.get(HDR_NUM_FUNCS)) r.broken();
+    std::vector<NodeFunc *> code;
+    for (uint32_t i = 0; i < num_funcs; i++) {
+        auto f = dynamic_cast<NodeFunc *>(child(true));
+        if (!f) r.broken();
+        code.push_back(f);
+    }
+    return code;
+}
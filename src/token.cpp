@@ -25,6 +25,8 @@ int is_alnum(char c) {
 // pが指している文字列をトークンに分割してtokensに保存する
 void tokenize(const char *p) {
     tokens.clear();
+    diagnostics.clear();
+    user_input = p;
 loop:
     while (*p) {
         // 空白文字をスキップ
@@ -36,7 +38,7 @@ loop:
         for (auto &&word: words) {
             auto s = std::get<0>(word);
             if (strncmp(p, s, strlen(s)) == 0 && !is_alnum(p[strlen(s)])) {
-                tokens.push_back(Token{std::get<1>(word), 0, p});
+                tokens.push_back(Token{std::get<1>(word), 0, "", p});
                 p += strlen(s);
                 goto loop;
             }
@@ -45,7 +47,7 @@ loop:
         for (auto &&sym : symbols) {
             auto op = std::get<0>(sym);
             if (!strncmp(p, op, strlen(op))) {
-                tokens.push_back(Token{std::get<1>(sym), 0, p});
+                tokens.push_back(Token{std::get<1>(sym), 0, "", p});
                 p += strlen(op);
                 goto loop;
             }
@@ -53,8 +55,8 @@ loop:
 
         if (*p == '+' || *p == '-' || *p == '*' || *p == '/' || *p == '(' ||
             *p == ')' || *p == '<' || *p == '>' || *p == '=' || *p == ';' ||
-            *p == '{' || *p == '}') {
-            tokens.push_back(Token{*p, 0, p});
+            *p == '{' || *p == '}' || *p == ',') {
+            tokens.push_back(Token{*p, 0, "", p});
             p++;
             continue;
         }
@@ -72,13 +74,14 @@ loop:
             char *tmp = nullptr;
             auto val = strtol(p, &tmp, 10);
             p = tmp;
-            tokens.push_back(Token{TK_NUM, static_cast<int>(val), last_p});
+            tokens.push_back(Token{TK_NUM, static_cast<int>(val), "", last_p});
             continue;
         }
 
-        error("トークナイズできません: %s", p);
-        exit(1);
+        // 読めない文字は報告して読み飛ばし、残りのトークナイズを続ける
+        error_at(p, "トークナイズできません");
+        p++;
     }
 
-    tokens.push_back(Token{TK_EOF, 0, p});
+    tokens.push_back(Token{TK_EOF, 0, "", p});
 }
@@ -3,6 +3,16 @@
 #include <cstdarg>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+// 入力プログラム全体とその名前（診断メッセージの位置計算用）
+const char *user_input;
+const char *input_name = "<command-line>";
+
+// パース中に見つかったエラーはこのベクタに溜めておく
+std::vector<Diagnostic> diagnostics;
 
 // エラーを報告するための関数
 // printfと同じ引数を取る
@@ -13,3 +23,64 @@ void error(const char *fmt, ...) {
     fprintf(stderr, "\n");
     exit(1);
 }
+
+// locの位置で見つかったエラーを記録する
+// 行・桁はreport_diagnostics()で表示するときに初めて計算する
+void error_at(const char *loc, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    diagnostics.push_back(Diagnostic{loc, buf});
+}
+
+// locの行番号と桁番号
+// 行頭の位置の表を一度だけ作り、二分探索で引く
+SourcePos source_pos(const char *loc) {
+    static const char *input = nullptr;
+    static std::vector<const char *> line_starts;
+
+    if (input != user_input) {
+        input = user_input;
+        line_starts = {user_input};
+        for (auto p = user_input; *p; p++)
+            if (*p == '\n') line_starts.push_back(p + 1);
+    }
+
+    auto iter = std::upper_bound(line_starts.begin(), line_starts.end(), loc);
+    int line = iter - line_starts.begin();
+    return SourcePos{line, static_cast<int>(loc - line_starts[line - 1]) + 1};
+}
+
+// 記録されているエラーを全て表示し、その件数を返す
+int report_diagnostics() {
+    // トークナイズ時のエラーとパース時のエラーをソース順に並べ直し、
+    // 行頭と行番号を前回の位置から進めながら計算する
+    std::stable_sort(diagnostics.begin(), diagnostics.end(),
+                     [](auto &a, auto &b) { return a.loc < b.loc; });
+
+    const char *line = user_input;
+    const char *scanned = user_input;
+    int line_no = 1;
+
+    for (auto &d : diagnostics) {
+        for (; scanned < d.loc; scanned++) {
+            if (*scanned == '\n') {
+                line = scanned + 1;
+                line_no++;
+            }
+        }
+
+        auto end = strchr(line, '\n');
+        int len = end ? end - line : strlen(line);
+        int col = d.loc - line;
+
+        fprintf(stderr, "%s:%d:%d: %s\n", input_name, line_no, col + 1,
+                d.msg.c_str());
+        fprintf(stderr, "  %.*s\n", len, line);
+        fprintf(stderr, "  %*s^\n", col, "");
+    }
+
+    return diagnostics.size();
+}
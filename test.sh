@@ -8,10 +8,133 @@ try() {
   ./tmp
   actual="$?"
 
-  if [ "$actual" = "$expected" ]; then
+  # インタプリタでも同じ結果になるか
+  ./build/9cc --interpret "$input"
+  interpreted="$?"
+
+  if [ "$actual" = "$expected" ] && [ "$interpreted" = "$expected" ]; then
     echo "$input => $actual"
   else
-    echo "$expected expected, but got $actual"
+    echo "$expected expected, but got $actual / $interpreted (interpreted)"
+    exit 1
+  fi
+}
+
+# 計測用のビルドで実行回数を取り、それを使ったビルドでも同じ結果になるか
+# 3番目の引数はプロファイルのファイル名（既定値tmp.prof）
+try_pgo() {
+  expected="$1"
+  input="$2"
+  prof="${3:-tmp.prof}"
+
+  rm -f "$prof"
+  ./build/9cc --instrument="$prof" "$input" > tmp.s
+  gcc -o tmp tmp.s
+  ./tmp
+  instrumented="$?"
+
+  ./build/9cc --profile-use="$prof" "$input" > tmp.s
+  gcc -o tmp tmp.s
+  ./tmp
+  actual="$?"
+
+  if [ -f "$prof" ] && [ "$instrumented" = "$expected" ] && [ "$actual" = "$expected" ]; then
+    echo "[pgo] $input => $actual"
+  else
+    echo "[pgo] $expected expected, but got $instrumented / $actual (or $prof missing)"
+    exit 1
+  fi
+}
+
+# -gのコードも同じ結果になり、文の行が行番号の表に載るか
+try_debug() {
+  expected="$1"
+  line="$2"
+  input="$3"
+
+  ./build/9cc -g "$input" > tmp.s
+  gcc -o tmp tmp.s
+  ./tmp
+  actual="$?"
+
+  if [ "$actual" = "$expected" ] && objdump --dwarf=decodedline tmp | grep -q " $line  *0x"; then
+    echo "[debug] $input => $actual"
+  else
+    echo "[debug] $expected expected, but got $actual (or line $line missing)"
+    exit 1
+  fi
+}
+
+# 書き出した構文木を読み込んで翻訳しても、ソースからと同じアセンブリになるか
+try_ast() {
+  input="$1"
+
+  ./build/9cc -g --emit-ast=tmp.ast "$input" > tmp.s
+  ./build/9cc -g --load-ast=tmp.ast > tmp2.s
+  if cmp -s tmp.s tmp2.s; then
+    echo "[ast] $input"
+  else
+    echo "[ast] $input: assembly differs after reloading"
+    exit 1
+  fi
+}
+
+# 複数のスレッドで生成しても、1スレッドと同じアセンブリになるか
+try_jobs() {
+  name="$1"
+
+  ./build/9cc -f tmp.c > tmp.s
+  # 見積もりが外れて1スレッドに戻ったときは標準エラーに出るので、それも失敗にする
+  ./build/9cc --jobs=4 -f tmp.c > tmp2.s 2> tmp.err
+  if cmp -s tmp.s tmp2.s && [ ! -s tmp.err ]; then
+    echo "[jobs] $name"
+  else
+    echo "[jobs] $name: assembly differs from the serial output or fell back to serial"
+    cat tmp.err
+    exit 1
+  fi
+}
+
+# 非常に深い式を、スタックを1MBに制限しても翻訳できるか
+# 入力はコマンドライン引数に収まらないのでファイルにして渡す
+DEEP=1000000
+repeat() {
+  yes "$1" | head -n "$2" | tr -d '\n'
+}
+
+try_deep() {
+  expected="$1"
+  name="$2"
+
+  (ulimit -s 1024; ./build/9cc -f tmp.c > tmp.s) || {
+    echo "[deep] $name: 9cc failed"
+    exit 1
+  }
+  gcc -o tmp tmp.s
+  ./tmp
+  actual="$?"
+
+  (ulimit -s 1024; ./build/9cc --interpret -f tmp.c)
+  interpreted="$?"
+
+  if [ "$actual" = "$expected" ] && [ "$interpreted" = "$expected" ]; then
+    echo "[deep] $name => $actual"
+  else
+    echo "[deep] $name: $expected expected, but got $actual / $interpreted (interpreted)"
+    exit 1
+  fi
+}
+
+# 不正なオプションの値は使い方を表示して終了コード1で終わるか
+try_bad_option() {
+  option="$1"
+
+  ./build/9cc "$option" 'return 0;' > tmp.s 2> tmp.err
+  actual="$?"
+  if [ "$actual" = 1 ] && grep -q "使い方" tmp.err; then
+    echo "[option] $option => rejected"
+  else
+    echo "[option] $option: expected to be rejected, but got $actual"
     exit 1
   fi
 }
@@ -51,5 +174,77 @@ try 20 'a=0;for(i=0;i<10;i=i+1) a = a+2; return a;'
 try 10 'a=0;for(;a<10;a=a+1); return a;'
 try 10 'a=0;while(a<10)a=a+1;return a;'
 try 1 'a=0; if (a<2) { a = a+1; return a;} return a;'
+try 7 'add(a,b){return a+b;} return add(3,4);'
+try 21 'add6(a,b,c,d,e,f){return a+b+c+d+e+f;} return add6(1,2,3,4,5,6);'
+try 55 'fib(n){if(n<2)return n; return fib(n-1)+fib(n-2);} return fib(10);'
+try 3 'main(){return 3;}'
+try 8 'one(){return 1;} a=1; b=one()+one(); return a+b+one()*5;'
+try 5 'return labs(0-5);'
+try 7 'f(a){if(a<0) return 0-a; return a+1;} return f(0-4)+f(2);'
+try 17 'sq(x){return x*x;} f(a){if(a<0) return 0-a; b=sq(a); return b+1;} return f(3)+f(0-2)+sq(2)+1;'
+try 48 'a=3;b=4; return a*b+a*b+a*b+b*a;'
+try 29 'a=3;b=4; x=a*b+a*b; if (a<b) x=x+1; while(a<b) a=a+1; return x+a;'
+try 14 'a=3;b=4; x=a*b; a=a+1; y=a*b; return y-x+10;'
+try 6 'a=1;b=2; if (a<b) c=a+b; else c=0; a=5; return c+(a+b)-(b+a)+a+b-4;'
+try 55 'sum(n){s=0; for(i=1;i<=n;i=i+1) s=s+i; return s;} a=0; for(j=0;j<2;j=j+1) a=a+sum(5)+labs(0-j); return a+24;'
+try 36 'f(a,b,c,d,e,g){x=a;y=b;z=c;w=d;v=e;u=g;t=x+y;return t+z+w+v+u+x+y+z-a-b-c+labs(0-15);} return f(1,2,3,4,5,6);'
+try 51 'a=100; b=a/4; c=b*8/16; return 0-c+(b-0)+(1-a+b*2)+a-b+12;'
+try 2 'a=5; b=7; return (3<a)+(b>a)-(a>=b)-(9<=a)+(1+a==b-1)-(a!=5)-1;'
+try 5 'a=1; a=a+1; a=a*3; a=a-1; b=2; b=b+a; b=b*a; return b-a-25;'
+try 14 'x=2; y=3; z=x*y; x=x+y*2; return x+z;'
+try 43 'min(a,b){if (a<b) return a; else return b;} max(a,b){if (a>b) x=a; else x=b; return x;} return min(3,9)+max(4,2)*10;'
+try 115 's=0; for(i=0;i<20;i=i+1){ if (i*7-(i/3)*20 < 5) s=s+i; else s=s-1; } return s+100;'
+try 23 'a=2;b=9; if (a+b==11) c=1; else c=a*b+1; if (a+b<5) d=a+b; else d=(a+b)*2; return c+d;'
+try 15 'a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8; if (g<h) x=e; else x=f; if (h<g) y=7; else y=a; return x+y+b+c+d;'
+try 6 'f(n){ if (n==0) { return 1; } else { return n; } } return f(0)+f(5);'
+# 最後の文がifなら、通った方の腕の値が返り値になる（インタプリタでも同じ）
+try 5 'a=5; if (a) a;'
+try 5 'f(){ a=5; if (a) a; } return f();'
+try 42 'g(x){ if (x) { x=x+3; 4; } else 2; } return g(1)*10+g(0);'
+
+try_pgo 200 'f(x){ if (x<3) return 1; else return 2; } s=0; for(i=0;i<100;i=i+1){ if (i==7) s=s+5; else s=s+f(i); } return s;'
+try_pgo 45 'a=0; i=0; while(i<10){ if (i>100) a=a-1; a=a+i; i=i+1; } return a;'
+# ファイル名の"や\はアセンブリの文字列の中でエスケープする
+try_pgo 45 'a=0; i=0; while(i<10){ a=a+i; i=i+1; } return a;' 'tmp"\.prof'
+rm -f 'tmp"\.prof'
+
+try_debug 45 3 'sum(n){
+  s=0;
+  for(i=0;i<10;i=i+1)
+    s=s+i;
+  return s;
+} return sum(10);'
+
+# ファイル名の"や\は.fileの中でエスケープし、そのまま行番号の表に載る
+echo 'return 3;' > 'tmp"\.c'
+./build/9cc -g -f 'tmp"\.c' > tmp.s && gcc -o tmp tmp.s && ./tmp
+actual="$?"
+rm -f 'tmp"\.c'
+if [ "$actual" = 3 ] && objdump --dwarf=decodedline tmp | grep -qF 'tmp"\.c'; then
+  echo "[debug] -f 'tmp\"\\.c' => $actual"
+else
+  echo "[debug] 3 expected, but got $actual (or file name missing)"
+  exit 1
+fi
+
+try_ast 'sum(n){ s=0; for(i=1;i<=n;i=i+1) s=s+i; return s; } a=0; while(a<3) a=a+1; if (a==3) a=sum(a); return a;'
+
+{ echo 'f(x){ if (x<3) return x; s=0; while(x>0) { x=x-1; s=s+x; } return s; }'
+  for i in $(seq 1 300); do echo "a=f($i)+a; if (a<$i) b=a; else b=$i; for(i=0;i<2;i=i+1) b=b+i;"; done
+  echo 'return b;'; } > tmp.c
+try_jobs "300 top-level statements"
+
+{ echo -n 'return '; repeat '(' $DEEP; echo -n 1; repeat ')' $DEEP; echo ';'; } > tmp.c
+try_deep 1 "$DEEP nested parentheses"
+{ repeat 'a=' $DEEP; echo '7; return a;'; } > tmp.c
+try_deep 7 "$DEEP chained assignments"
+{ echo -n 'a=0; return '; repeat '(' $DEEP; echo -n a; repeat '+1)' $DEEP; echo ';'; } > tmp.c
+try_deep 64 "$DEEP nested additions"
+
+try_bad_option --inline-budget=abc
+try_bad_option --inline-budget=
+try_bad_option --inline-budget=-1
+try_bad_option --inline-budget=5x
+try_bad_option --inline-budget=1000001
 
 echo OK
@@ -0,0 +1,7 @@
+x=12345; a=0; b=0;
+for(i=0;i<2000000;i=i+1) {
+  x=x*1103515245+12345;
+  x=x-(x/2147483648)*2147483648;
+  if (x/65536-(x/131072)*2 == 1) a=a+1; else b=b+1;
+}
+return (a+b)/2000000+(a>b)*2+(a<b)*4;
@@ -0,0 +1,6 @@
+sq(x){ return x*x; }
+add3(a,b,c){ return a+b+c; }
+f(n){ s=0; for(i=0;i<n;i=i+1) s=add3(s,sq(i),1); return s; }
+t=0;
+for(k=0;k<2000;k=k+1) t=t+f(500);
+return t-(t/251)*251;
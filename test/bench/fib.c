@@ -0,0 +1,5 @@
+fib(n){
+  if (n<2) return n;
+  return fib(n-1)+fib(n-2);
+}
+return fib(27)-196418+1;
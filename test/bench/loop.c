@@ -0,0 +1,5 @@
+s=0;
+for(i=0;i<3000;i=i+1)
+  for(j=0;j<1000;j=j+1)
+    s=s+i*j+3;
+return s-(s/256)*256;
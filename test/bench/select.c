@@ -0,0 +1,9 @@
+max(a,b){ if (a>b) return a; else return b; }
+x=1; m=0;
+for(i=0;i<2000000;i=i+1) {
+  x=x*75+74;
+  x=x-(x/65537)*65537;
+  m=max(m,x);
+  if (x<m/2) y=x; else y=m;
+}
+return m/1000+y-y;
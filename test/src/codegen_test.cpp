@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "9cc.hpp"
+#include "compile.hpp"
+
+// srcをパースし、jobs個のスレッドでアセンブリにした文字列を返す
+static std::string compile(const std::string& src, int jobs, bool *parallel = nullptr) {
+    tokenize(src.c_str());
+    auto code = parse();
+    EXPECT_TRUE(diagnostics.empty());
+    return compile(code, false, jobs, parallel);
+}
+
+class CodegenTest : public testing::Test {};
+
+TEST_F(CodegenTest, parallel_test) {
+    // 関数の定義・インライン展開・分岐・ループ・cmovが混ざったトップレベルの文
+    std::string src =
+        "sq(x){ return x*x; }\n"
+        "f(a,b){ if (a<b) return a; s=0; while(a>b) { a=a-1; s=s+a; } return s; }\n"
+        "empty(){}\n";
+    for (int i = 0; i < 200; i++) {
+        auto n = std::to_string(i);
+        src += "a" + std::to_string(i % 7) + "=sq(" + n + ")+f(" + n + ",3);";
+        src += "if (a1<" + n + ") b=a1; else b=a2;";
+        src += "for(j=0;j<3;j=j+1) if (j==1) c=c+b; else c=c-1;";
+    }
+    src += "return c+empty();";
+
+    bool parallel;
+    auto expect = compile(src, 1, &parallel);
+    EXPECT_FALSE(parallel);
+    for (int jobs : {2, 3, 8, 64}) {
+        EXPECT_EQ(compile(src, jobs, &parallel), expect) << "jobs=" << jobs;
+        EXPECT_TRUE(parallel) << "jobs=" << jobs;
+    }
+
+    // 計測用のカウンタを埋め込むときも同じ
+    profile.instrument = true;
+    expect = compile(src, 1);
+    EXPECT_EQ(compile(src, 4, &parallel), expect);
+    EXPECT_TRUE(parallel);
+    profile.instrument = false;
+}
@@ -0,0 +1,21 @@
+// テストで共通に使う、最適化をかけてアセンブリを出力する手順
+#pragma once
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "9cc.hpp"
+
+// 9ccの既定の設定で最適化をかけてから、jobs個のスレッドでアセンブリを出力した文字列を返す
+// parallelには複数のスレッドで生成できたかを入れる（見積もりが外れて1スレッドに
+// 戻ると、出力は同じでも並列の経路を試したことにならないため）
+inline std::string compile(std::vector<NodeFunc*> code, bool debug_info, int jobs = 1,
+                           bool *parallel = nullptr) {
+    assign_probes(code);
+    run_optimizations(code, DEFAULT_INLINE_BUDGET, false);
+
+    testing::internal::CaptureStdout();
+    bool used = code_gen(code, debug_info, jobs);
+    if (parallel) *parallel = used;
+    return testing::internal::GetCapturedStdout();
+}
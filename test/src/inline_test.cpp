@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "9cc.hpp"
+
+class InlineTest : public testing::Test {
+protected:
+    // srcをbudgetでインライン展開し、--inline-reportの出力を返す
+    std::string report(const char* src, int budget) {
+        tokenize(src);
+        auto code = parse();
+        testing::internal::CaptureStderr();
+        inline_functions(code, budget, true);
+        return testing::internal::GetCapturedStderr();
+    }
+};
+
+// outの中でkeyを含む最初の行（なければ空文字列）
+static std::string line_of(const std::string& out, const std::string& key) {
+    auto pos = out.find(key);
+    if (pos == std::string::npos) return "";
+    auto begin = out.rfind('\n', pos);
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    return out.substr(begin, out.find('\n', pos) - begin);
+}
+
+static const char* program =
+    "sq(x){ return x*x; }\n"
+    "fib(n){ if (n<2) return n; return fib(n-1)+fib(n-2); }\n"
+    "return sq(3)+fib(5);\n";
+
+TEST_F(InlineTest, report_test) {
+    auto out = report(program, DEFAULT_INLINE_BUDGET);
+    EXPECT_NE(out.find("inlined sq"), std::string::npos) << out;
+    EXPECT_EQ(out.find("not inlined sq"), std::string::npos) << out;
+    EXPECT_NE(line_of(out, "fib: not inlined fib").find("recursive"), std::string::npos) << out;
+}
+
+TEST_F(InlineTest, budget_test) {
+    auto out = report(program, 1);
+    EXPECT_NE(line_of(out, "not inlined sq").find("too large"), std::string::npos) << out;
+    EXPECT_EQ(out.find(": inlined"), std::string::npos) << out;
+
+    // 展開しないときは何も出力しない
+    EXPECT_EQ(report(program, 0), "");
+}
@@ -68,6 +68,20 @@ bool operator==(const Node& lhs, const Node& rhs) {
     } catch(...) {
     }
 
+    try {
+        auto l = dynamic_cast<const NodeCall&>(lhs);
+        auto r = dynamic_cast<const NodeCall&>(rhs);
+
+        if (l.name != r.name || l.args.size() != r.args.size()) return false;
+
+        for(size_t i=0; i<l.args.size(); i++) {
+            if (!(*l.args[i] == *r.args[i])) return false;
+        }
+
+        return true;
+    } catch(...) {
+    }
+
     try {
         auto l = dynamic_cast<const NodeBlock&>(lhs);
         auto r = dynamic_cast<const NodeBlock&>(rhs);
@@ -93,6 +107,7 @@ Node* new_node_if(Node* cond, Node* then, Node* els);
 Node *new_node_for(Node* init, Node* cond, Node* proc, Node* block);
 Node *new_node_while(Node* cond, Node* block);
 Node *new_node_block(std::vector<Node*>&& stmts);
+Node *new_node_call(const std::string& name, std::vector<Node*>&& args);
 
 class ParseTest : public testing::Test {};
 
@@ -246,3 +261,140 @@ TEST_F(ParseTest, stmt_test) {
         EXPECT_EQ(*actual, *expect);
     }
 }
+
+TEST_F(ParseTest, error_recovery_test) {
+    {
+        tokenize("a=; b=1; c=(; d=2;");
+        auto code = parse()[0]->body;
+        ASSERT_EQ(diagnostics.size(), 2u);
+        EXPECT_EQ(diagnostics[0].loc - user_input, 2);
+        EXPECT_EQ(diagnostics[1].loc - user_input, 12);
+        ASSERT_EQ(code.size(), 2u);
+        EXPECT_EQ(*code[0], *new_node('=', new_node_ident("b"), new_node_num(1)));
+        EXPECT_EQ(*code[1], *new_node('=', new_node_ident("d"), new_node_num(2)));
+    }
+
+    {
+        tokenize("{a=1; b=+; c=2;} if (1 a=3; e=4;");
+        auto code = parse()[0]->body;
+        ASSERT_EQ(diagnostics.size(), 2u);
+        ASSERT_EQ(code.size(), 2u);
+        EXPECT_EQ(*code[0], *new_node_block(std::vector{
+                    new_node('=', new_node_ident("a"), new_node_num(1)),
+                    new_node('=', new_node_ident("c"), new_node_num(2))}));
+        EXPECT_EQ(*code[1], *new_node('=', new_node_ident("e"), new_node_num(4)));
+    }
+
+    {
+        tokenize("a=1 $ 2;");
+        parse();
+        ASSERT_EQ(diagnostics.size(), 2u);
+        EXPECT_EQ(diagnostics[0].loc - user_input, 4);
+    }
+}
+
+TEST_F(ParseTest, precedence_test) {
+    {
+        tokenize("a=b=1");
+        parser_init();
+        Node* actual = assign();
+        Node* expect = new_node('=', new_node_ident("a"),
+                                new_node('=', new_node_ident("b"), new_node_num(1)));
+        EXPECT_EQ(*actual, *expect);
+    }
+
+    {
+        tokenize("1-2-3");
+        parser_init();
+        Node* actual = add();
+        Node* expect = new_node('-', new_node('-', new_node_num(1), new_node_num(2)),
+                                new_node_num(3));
+        EXPECT_EQ(*actual, *expect);
+    }
+
+    {
+        tokenize("1+2*3<4==a=5");
+        parser_init();
+        Node* actual = assign();
+        Node* expect = new_node(
+            '=',
+            new_node(ND_EQ,
+                     new_node('<',
+                              new_node('+', new_node_num(1),
+                                       new_node('*', new_node_num(2), new_node_num(3))),
+                              new_node_num(4)),
+                     new_node_ident("a")),
+            new_node_num(5));
+        EXPECT_EQ(*actual, *expect);
+    }
+}
+
+TEST_F(ParseTest, func_test) {
+    {
+        tokenize("foo(1, a+1, bar());");
+        parser_init();
+        Node* actual = stmt();
+        Node* expect = new_node_call(
+            "foo", std::vector{new_node_num(1),
+                               new_node('+', new_node_ident("a"), new_node_num(1)),
+                               new_node_call("bar", {})});
+        EXPECT_EQ(*actual, *expect);
+    }
+
+    {
+        tokenize("add(a, b) { c = a + b; return c; } x = add(1, 2); return x;");
+        auto funcs = parse();
+        ASSERT_TRUE(diagnostics.empty());
+        ASSERT_EQ(funcs.size(), 2u);
+        EXPECT_EQ(funcs[0]->name, "add");
+        EXPECT_EQ(funcs[0]->params, (std::vector<std::string>{"a", "b"}));
+        EXPECT_EQ(funcs[0]->locals, (std::vector<std::string>{"a", "b", "c"}));
+        EXPECT_EQ(funcs[0]->body.size(), 2u);
+        EXPECT_EQ(funcs[1]->name, "main");
+        EXPECT_EQ(funcs[1]->locals, (std::vector<std::string>{"x"}));
+        EXPECT_EQ(funcs[1]->body.size(), 2u);
+    }
+
+    {
+        tokenize("f(1,2,3,4,5,6,7); main() { return 0; }");
+        parse();
+        EXPECT_EQ(diagnostics.size(), 2u);
+    }
+}
+
+TEST_F(ParseTest, deep_test) {
+    {
+        tokenize("-(((a)))*-b+f(-1,(2))");
+        parser_init();
+        Node* actual = assign();
+        Node* expect = new_node(
+            '+',
+            new_node('*', new_node('-', new_node_num(0), new_node_ident("a")),
+                     new_node('-', new_node_num(0), new_node_ident("b"))),
+            new_node_call("f", std::vector{new_node('-', new_node_num(0), new_node_num(1)),
+                                           new_node_num(2)}));
+        EXPECT_EQ(*actual, *expect);
+    }
+
+    {
+        // 再帰下降ならスタックを使い切る深さでも読めること
+        // （operator==は再帰するので、ここでは木を順にたどって確かめる）
+        const int depth = 200000;
+        std::string src;
+        for (int i = 0; i < depth; i++) src += "a=";
+        src += std::string(depth, '(');
+        src += "1";
+        src += std::string(depth, ')');
+        tokenize(src.c_str());
+        parser_init();
+        Node* node = assign();
+        ASSERT_TRUE(diagnostics.empty());
+        for (int i = 0; i < depth; i++) {
+            auto n = dynamic_cast<NodeGeneral*>(node);
+            ASSERT_NE(n, nullptr);
+            ASSERT_EQ(n->ty, '=');
+            node = n->rhs;
+        }
+        EXPECT_EQ(*node, *new_node_num(1));
+    }
+}
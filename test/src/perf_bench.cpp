@@ -0,0 +1,411 @@
+// 9ccが生成したコードの性能をハードウェアカウンタで測り、基準値と比べるベンチマーク
+//
+// test/bench/*.cを9ccとgccでビルドして数回ずつ実行し、perf_event_openで
+// サイクル数・命令数・分岐予測ミス・L1データキャッシュのミスを数える。
+// 各カウンタは実行ごとの最小値を採る（割り込みなどの雑音は増える方向にしか働かないため）。
+// カウンタは1つのグループとして開き、多重化されて一部の期間しか数えなかった実行は捨てる。
+//
+// 基準値のファイルには、プログラムごとに終了コードと各カウンタの値を保存する。
+// 基準値より閾値以上悪化したカウンタがあるか、終了コードが変わったら失敗する。
+// 基準値のないプログラムはその場で測った値を基準値として追加する。
+//
+// ハードウェアカウンタが使えない環境（仮想マシンやperf_event_paranoidの設定など）では
+// 終了コードだけを確かめる。比べなかったカウンタは全て警告し、1つも測れなければ
+// 失敗がない場合でも終了コード77（飛ばした）で終わる。
+//
+// 使い方: perf_bench [オプション] [プログラム...]
+//   --9cc=PATH       使う9cc（既定値はビルドした9cc）
+//   --baseline=F     基準値のファイル
+//   --runs=N         1プログラムあたりの実行回数（既定値5）
+//   --threshold=P    悪化とみなす増加率（%、既定値5）
+//   --update         全てのプログラムの基準値を測り直す
+//   --allow-no-counters  カウンタを1つも測れなくても、終了コードが合えば成功にする
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef BENCH_DIR
+#define BENCH_DIR "bench"
+#endif
+#ifndef BASELINE_PATH
+#define BASELINE_PATH "perf_baseline.txt"
+#endif
+#ifndef NINECC_PATH
+#define NINECC_PATH "9cc"
+#endif
+
+// 数えるカウンタ
+struct Counter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const Counter counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"L1-dcache-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+constexpr int NUM_COUNTERS = sizeof(counters) / sizeof(counters[0]);
+
+// これより少ない回数のカウンタは雑音が大きいので比べない
+constexpr long MIN_COMPARED_COUNT = 10000;
+
+// 測れなかったカウンタの値
+constexpr long NOT_COUNTED = -1;
+
+// カウンタを1つも測れなかったときの終了コード（ctestなどで「飛ばした」を表す値）
+constexpr int EXIT_SKIPPED = 77;
+
+// 1プログラムの結果
+struct Result {
+    int status = -1;                           //! 終了コード
+    std::vector<long> counts = std::vector<long>(NUM_COUNTERS, NOT_COUNTED);
+};
+
+struct Options {
+    std::string ninecc = NINECC_PATH;
+    std::string baseline = BASELINE_PATH;
+    int runs = 5;
+    double threshold = 5;
+    bool update = false;
+    bool allow_no_counters = false;
+    std::vector<std::string> programs;
+};
+
+static long perf_event_open(perf_event_attr *attr, pid_t pid, int group_fd) {
+    return syscall(SYS_perf_event_open, attr, pid, -1, group_fd, 0);
+}
+
+// 子プロセスpidのcounterを数えるファイル記述子（開けなければ-1）
+// 子がexecした時点から、ユーザ空間の命令だけを数える
+// group_fdが-1なら新しいグループのリーダーとして開き、そうでなければそのグループに加える。
+// 同じグループのカウンタはまとめてPMUに載るので、互いに違う期間を数えることはない
+static int open_counter(const Counter &counter, pid_t pid, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter.type;
+    attr.config = counter.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if (group_fd < 0) {
+        // メンバーはリーダーに合わせて有効になる
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+    }
+    return perf_event_open(&attr, pid, group_fd);
+}
+
+// 各カウンタを使えるか（自分自身について1つずつ開いてみる）
+// 使えないカウンタはここで警告し、以後は比べない
+static std::vector<bool> counters_available() {
+    std::vector<bool> available;
+    for (auto &counter : counters) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter.type;
+        attr.config = counter.config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = perf_event_open(&attr, 0, -1);
+        if (fd < 0)
+            fprintf(stderr, "[perf] 警告: %sを使えません（%s）。このカウンタは比べません\n",
+                    counter.name, strerror(errno));
+        else
+            close(fd);
+        available.push_back(fd >= 0);
+    }
+    return available;
+}
+
+// グループで開いたカウンタの値を読み、countsに入れる
+// カウンタが多重化されて実行中の一部しか数えていなければfalseを返す
+static bool read_group(const std::vector<int> &fds, std::vector<long> &counts) {
+    std::fill(counts.begin(), counts.end(), NOT_COUNTED);
+    auto leader = std::find_if(fds.begin(), fds.end(), [](int fd) { return fd >= 0; });
+    if (leader == fds.end()) return true;
+
+    // 形式は {nr, time_enabled, time_running, 開いた順の値...}
+    uint64_t buf[3 + NUM_COUNTERS];
+    if (read(*leader, buf, sizeof(buf)) < 3 * static_cast<long>(sizeof(uint64_t))) return true;
+    if (buf[2] < buf[1]) return false;
+    uint64_t n = 0;
+    for (size_t i = 0; i < fds.size() && n < buf[0]; i++)
+        if (fds[i] >= 0) counts[i] = buf[3 + n++];
+    return true;
+}
+
+// exeを1回実行し、終了コードを返す
+// measureなら各カウンタの値をcountsに入れる（開けなかったカウンタはNOT_COUNTED）
+// カウンタが多重化された実行ではmultiplexedをtrueにし、countsは全てNOT_COUNTEDにする
+static int run_once(const std::string &exe, bool measure, std::vector<long> &counts,
+                    bool &multiplexed) {
+    // 子はカウンタを開き終わるまでパイプの読み込みで待ち、その後にexecする
+    int go[2];
+    if (pipe(go) != 0) return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(go[1]);
+        char c;
+        if (read(go[0], &c, 1) != 1) _exit(127);
+        execl(exe.c_str(), exe.c_str(), static_cast<char *>(nullptr));
+        _exit(127);
+    }
+    close(go[0]);
+
+    // 最初に開けたカウンタをリーダーにして、残りを同じグループに入れる
+    std::vector<int> fds;
+    int leader = -1;
+    if (measure) {
+        for (auto &counter : counters) {
+            fds.push_back(open_counter(counter, pid, leader));
+            if (leader < 0) leader = fds.back();
+        }
+    }
+    if (write(go[1], "x", 1) != 1) perror("write");
+    close(go[1]);
+
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    int status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+
+    multiplexed = !read_group(fds, counts);
+    if (multiplexed) std::fill(counts.begin(), counts.end(), NOT_COUNTED);
+    for (int fd : fds)
+        if (fd >= 0) close(fd);
+    return status;
+}
+
+// programを9ccとgccでexeにビルドする
+static bool build(const Options &opts, const std::string &program, const std::string &exe) {
+    std::string cmd = "'" + opts.ninecc + "' -f '" + program + "' > '" + exe + ".s' && gcc -o '" +
+                      exe + "' '" + exe + ".s' 2>/dev/null";
+    return system(cmd.c_str()) == 0;
+}
+
+static Result bench(const Options &opts, const std::string &program, const std::string &exe,
+                    bool measure) {
+    Result result;
+    if (!build(opts, program, exe)) {
+        fprintf(stderr, "[perf] %s: ビルドできません\n", program.c_str());
+        return result;
+    }
+
+    // 1回目はページキャッシュなどを温めるために捨てる
+    std::vector<long> counts(NUM_COUNTERS);
+    bool multiplexed;
+    result.status = run_once(exe, false, counts, multiplexed);
+    if (!measure) return result;
+
+    // 多重化された実行の値は一部の期間しか数えていないので捨てる
+    int discarded = 0;
+    for (int r = 0; r < opts.runs; r++) {
+        if (run_once(exe, true, counts, multiplexed) != result.status) {
+            fprintf(stderr, "[perf] %s: 実行ごとに終了コードが違います\n", program.c_str());
+            result.status = -1;
+            return result;
+        }
+        if (multiplexed) discarded++;
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (counts[i] == NOT_COUNTED) continue;
+            auto &best = result.counts[i];
+            best = best == NOT_COUNTED ? counts[i] : std::min(best, counts[i]);
+        }
+    }
+    if (discarded)
+        fprintf(stderr, "[perf] %s: カウンタが多重化されたため、%d回中%d回の計測を捨てました\n",
+                program.c_str(), opts.runs, discarded);
+    return result;
+}
+
+// 基準値のファイルを読む
+// 1行に「プログラム名 終了コード カウンタの値...」（測れなかった値は-1）、#以降は注釈
+static std::map<std::string, Result> load_baseline(const std::string &path) {
+    std::map<std::string, Result> baseline;
+    std::ifstream ifs(path);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ss(line);
+        std::string name;
+        Result r;
+        if (!(ss >> name >> r.status)) continue;
+        for (auto &c : r.counts) ss >> c;
+        baseline[name] = r;
+    }
+    return baseline;
+}
+
+static void save_baseline(const std::string &path, const std::map<std::string, Result> &baseline) {
+    std::ofstream ofs(path);
+    ofs << "# program status";
+    for (auto &counter : counters) ofs << " " << counter.name;
+    ofs << "\n";
+    for (auto &[name, r] : baseline) {
+        ofs << name << " " << r.status;
+        for (auto c : r.counts) ofs << " " << c;
+        ofs << "\n";
+    }
+}
+
+static std::string base_name(const std::string &path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::vector<std::string> default_programs() {
+    std::vector<std::string> programs;
+    if (auto dir = opendir(BENCH_DIR)) {
+        while (auto ent = readdir(dir)) {
+            std::string name = ent->d_name;
+            if (name.size() > 2 && name.substr(name.size() - 2) == ".c")
+                programs.push_back(std::string(BENCH_DIR) + "/" + name);
+        }
+        closedir(dir);
+    }
+    std::sort(programs.begin(), programs.end());
+    return programs;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "使い方: perf_bench [--9cc=PATH] [--baseline=F] [--runs=N] [--threshold=P] "
+            "[--update] [--allow-no-counters] [プログラム...]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--9cc=", 6) == 0) {
+            opts.ninecc = arg + 6;
+        } else if (strncmp(arg, "--baseline=", 11) == 0) {
+            opts.baseline = arg + 11;
+        } else if (strncmp(arg, "--runs=", 7) == 0) {
+            opts.runs = atoi(arg + 7);
+            if (opts.runs < 1) usage();
+        } else if (strncmp(arg, "--threshold=", 12) == 0) {
+            opts.threshold = atof(arg + 12);
+        } else if (strcmp(arg, "--update") == 0) {
+            opts.update = true;
+        } else if (strcmp(arg, "--allow-no-counters") == 0) {
+            opts.allow_no_counters = true;
+        } else if (arg[0] == '-') {
+            usage();
+        } else {
+            opts.programs.push_back(arg);
+        }
+    }
+    if (opts.programs.empty()) opts.programs = default_programs();
+    if (opts.programs.empty()) {
+        fprintf(stderr, "[perf] プログラムがありません: %s\n", BENCH_DIR);
+        return 1;
+    }
+
+    char tmpdir[] = "/tmp/9cc_perf_XXXXXX";
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    auto available = counters_available();
+    bool measure = std::find(available.begin(), available.end(), true) != available.end();
+    auto baseline = load_baseline(opts.baseline);
+    bool changed = false;
+    bool measured = false;   // 1つでもカウンタの値を得られたか
+    int failures = 0;
+
+    for (auto &program : opts.programs) {
+        auto name = base_name(program);
+        auto result = bench(opts, program, std::string(tmpdir) + "/a.out", measure);
+        if (result.status < 0) {
+            failures++;
+            continue;
+        }
+        for (auto c : result.counts)
+            if (c != NOT_COUNTED) measured = true;
+
+        auto iter = baseline.find(name);
+        if (opts.update || iter == baseline.end()) {
+            // 計測できない環境では、既にある基準値のカウンタは消さずに残す
+            if (!measure && iter != baseline.end()) result.counts = iter->second.counts;
+            baseline[name] = result;
+            changed = true;
+            printf("[perf] %s: 基準値を記録しました（終了コード %d）\n", name.c_str(),
+                   result.status);
+            continue;
+        }
+
+        auto &base = iter->second;
+        bool ok = true;
+        if (result.status != base.status) {
+            printf("[perf] %s: 終了コードが %d から %d に変わりました\n", name.c_str(),
+                   base.status, result.status);
+            ok = false;
+        }
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            // 使えないカウンタはcounters_availableで警告済み
+            if (!available[i]) continue;
+            long now = result.counts[i], &before = base.counts[i];
+            if (now == NOT_COUNTED) {
+                fprintf(stderr, "[perf] 警告: %s: %sを測れなかったので比べません\n",
+                        name.c_str(), counters[i].name);
+                continue;
+            }
+            if (before == NOT_COUNTED) {
+                // 計測できない環境で記録した基準値は、測れるようになったら埋める
+                before = now;
+                changed = true;
+                fprintf(stderr, "[perf] 警告: %s: %sの基準値がなかったので記録しました。今回は比べません\n",
+                        name.c_str(), counters[i].name);
+                continue;
+            }
+            if (before < MIN_COMPARED_COUNT)
+                fprintf(stderr, "[perf] 警告: %s: %sは基準値が%ld未満なので比べません\n",
+                        name.c_str(), counters[i].name, MIN_COMPARED_COUNT);
+            double change = before ? 100.0 * (now - before) / before : 0;
+            bool regressed = before >= MIN_COMPARED_COUNT && change > opts.threshold;
+            printf("[perf] %s: %-16s %12ld -> %12ld (%+.1f%%)%s\n", name.c_str(),
+                   counters[i].name, before, now, change, regressed ? " 悪化" : "");
+            if (regressed) ok = false;
+        }
+        if (!measure) printf("[perf] %s: 終了コード %d\n", name.c_str(), result.status);
+        if (!ok) failures++;
+    }
+
+    if (changed) save_baseline(opts.baseline, baseline);
+    std::string cleanup = std::string("rm -rf '") + tmpdir + "'";
+    if (system(cleanup.c_str()) != 0) perror("rm");
+
+    if (failures) {
+        printf("[perf] %d個のプログラムで失敗しました\n", failures);
+        return 1;
+    }
+    if (!measured && !opts.allow_no_counters) {
+        printf("[perf] SKIP: カウンタを1つも測れませんでした（終了コードだけ確かめました）\n");
+        return EXIT_SKIPPED;
+    }
+    printf("[perf] OK\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "9cc.hpp"
+#include "compile.hpp"
+
+class SerializeTest : public testing::Test {
+protected:
+    std::string path;
+
+    void SetUp() override {
+        char tmpl[] = "/tmp/9cc_ast_XXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        path = tmpl;
+    }
+
+    void TearDown() override { unlink(path.c_str()); }
+
+    // ソースから翻訳した結果と、書き出して読み戻した木から翻訳した結果が一致するか
+    void round_trip(const std::string& src) {
+        // 前回読み込んだファイルを指したままにしない（同じファイルを書き直すので）
+        input_name = "<command-line>";
+        tokenize(src.c_str());
+        auto code = parse();
+        ASSERT_TRUE(diagnostics.empty());
+        save_ast(path.c_str(), code);
+        auto expect = compile(code, true);
+
+        user_input = nullptr;
+        auto loaded = load_ast(path.c_str());
+        ASSERT_NE(user_input, nullptr);
+        EXPECT_EQ(std::string(user_input), src);
+        EXPECT_EQ(compile(loaded, true), expect);
+    }
+};
+
+TEST_F(SerializeTest, round_trip_test) {
+    round_trip("return 1+2*3;");
+    round_trip("a=3; b=a*a; if (a<b) c=1; else c=2; return c;");
+    round_trip(
+        "sum(n){\n"
+        "  s=0;\n"
+        "  for(i=1;i<=n;i=i+1) s=s+i;\n"
+        "  return s;\n"
+        "}\n"
+        "f(a,b){ while(a<b) { a=a+1; } for(;;) return labs(0-a); }\n"
+        "return sum(10)+f(1,5);\n");
+}
+
+TEST_F(SerializeTest, deep_test) {
+    // 書き出しも読み込みも再帰しないこと
+    const int depth = 200000;
+    std::string src = "a=1; return ";
+    src += std::string(depth, '(');
+    src += "a";
+    for (int i = 0; i < depth; i++) src += "+1)";
+    src += ";";
+    round_trip(src);
+}
+
+TEST_F(SerializeTest, version_test) {
+    tokenize("return 0;");
+    auto code = parse();
+    save_ast(path.c_str(), code);
+
+    // 版数を書き換えたファイルは読み込まずに終了する
+    auto fp = fopen(path.c_str(), "r+b");
+    ASSERT_NE(fp, nullptr);
+    fseek(fp, 8, SEEK_SET);
+    fputc(99, fp);
+    fclose(fp);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+}
+
+// 書き出したファイルの中身を読み書きする
+static std::string read_all(const std::string& path) {
+    std::string data;
+    auto fp = fopen(path.c_str(), "rb");
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) data.append(buf, n);
+    fclose(fp);
+    return data;
+}
+
+static void write_all(const std::string& path, const std::string& data) {
+    auto fp = fopen(path.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+}
+
+TEST_F(SerializeTest, too_many_args_test) {
+    // パーサを通らない木でも、引数がMAX_ARGSを超えるファイルは読み込まない
+    tokenize("return f(1,2,3,4,5,6);");
+    auto code = parse();
+    auto ret = dynamic_cast<NodeGeneral*>(code[0]->body[0]);
+    ASSERT_NE(ret, nullptr);
+    auto call = dynamic_cast<NodeCall*>(ret->lhs);
+    ASSERT_NE(call, nullptr);
+    call->args.push_back(new NodeNum(7));
+    save_ast(path.c_str(), code);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+
+    tokenize("f(a,b,c,d,e,g){ return a; } return 0;");
+    code = parse();
+    code[0]->params.push_back("h");
+    code[0]->locals.push_back("h");
+    save_ast(path.c_str(), code);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+}
+
+TEST_F(SerializeTest, truncated_test) {
+    tokenize("a=3; if (a<4) a=a+1; return a;");
+    auto code = parse();
+    save_ast(path.c_str(), code);
+    auto data = read_all(path);
+
+    // どこで切れていても読み込まずに終了する
+    for (size_t size : {data.size() - 4, data.size() / 2, size_t(40), size_t(8)}) {
+        write_all(path, data.substr(0, size));
+        EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "") << size;
+    }
+}
+
+TEST_F(SerializeTest, bad_child_test) {
+    tokenize("return 7+8;");
+    auto code = parse();
+    save_ast(path.c_str(), code);
+    auto data = read_all(path);
+
+    // 7+8のレコード（種類AST_GENERAL=2、通し番号2、演算子'+'、左辺、右辺）を探す
+    std::vector<uint32_t> words(data.size() / 4);
+    memcpy(words.data(), data.data(), words.size() * 4);
+    size_t plus = 0;
+    for (size_t i = 0; i + 4 < words.size(); i++)
+        if (words[i] == 2 && words[i + 1] == 2 && words[i + 2] == '+') plus = i;
+    ASSERT_NE(plus, 0u);
+    size_t lhs = plus + 3, rhs = plus + 4;
+
+    auto patched = [&](size_t at, uint32_t v) {
+        auto copy = words;
+        copy[at] = v;
+        std::string out(reinterpret_cast<const char*>(copy.data()), copy.size() * 4);
+        write_all(path, out);
+    };
+    // 後ろを指す参照、ファイルの外を指す参照、レコードの途中を指す参照、
+    // 同じ子を2回使う参照
+    patched(lhs, 4);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+    patched(lhs, 0x80000000u);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+    patched(lhs, words[lhs] + 4);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+    patched(lhs, words[rhs] + 4);
+    EXPECT_EXIT(load_ast(path.c_str()), testing::ExitedWithCode(1), "");
+
+    // 書き換えていなければ読み込める
+    patched(lhs, words[lhs]);
+    EXPECT_EQ(load_ast(path.c_str()).size(), 1u);
+}